@@ -0,0 +1,1555 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "FlatHashMap.hpp"
+#include "IExchange.hpp"
+#include "LatencyStats.hpp"
+#include "OrderCommand.hpp"
+#include "Pool.hpp"
+#include "PriceLevels.hpp"
+
+// Event sink of a BasicExchange. It is a compile-time parameter so that the
+// handlers can inline into the matching loop instead of going through
+// std::function; use Exchange for the IExchange callback interface.
+template <typename T>
+concept ExchangeListener =
+    requires(T &listener, InstrumentId instrument, std::uint64_t orderId,
+             std::int64_t price, std::uint32_t quantity) {
+        // An existing order has traded against an incoming one
+        listener.OnOrderTraded(instrument, orderId, price, quantity);
+        // The best bid or offer moved, an empty side reads as 0 / 0
+        listener.OnBestPriceChanged(instrument, price, quantity, price,
+                                    quantity);
+    };
+
+// Listeners may also define OnCommandComplete(), called once after each add
+// or cancel has been fully applied, e.g. to flush events they buffered (see
+// BufferedListener)
+template <typename T>
+concept CommandCompleteListener =
+    requires(T &listener) { listener.OnCommandComplete(); };
+
+// Listeners may also observe every accepted command, e.g. to journal them
+// (see Journal). Adds are reported before they match, so applying the
+// reported commands in order to an empty exchange reproduces its state.
+// Fill-or-kill orders that cannot fill are rejected, not reported.
+template <typename T>
+concept CommandRecorder = requires(T &listener, InstrumentId instrument,
+                                   const std::string &name,
+                                   const PriceBand *band, Side side,
+                                   std::uint64_t orderId, std::int64_t price,
+                                   std::uint32_t quantity,
+                                   TimeInForce timeInForce, OrderType type,
+                                   AccountId account) {
+    // band is null for a tree of levels
+    listener.OnInstrumentRegistered(instrument, name, band);
+    listener.OnOrderAccepted(instrument, side, orderId, price, quantity,
+                             timeInForce, type, account);
+    listener.OnOrderCancelled(instrument, side, orderId);
+    listener.OnOrderModified(instrument, side, orderId, price, quantity);
+};
+
+// How a command changed one price level of a book
+enum class LevelAction : std::uint8_t { ADD, CHANGE, DELETE };
+
+// Listeners may also follow the depth of every book, e.g. to publish L2
+// market data (see MarketDataPublisher). Called whenever a command changes a
+// level's total quantity, with the new total, 0 once the level is deleted.
+template <typename T>
+concept LevelListener = requires(T &listener, InstrumentId instrument,
+                                 Side side, LevelAction action,
+                                 std::int64_t price, std::uint32_t quantity) {
+    listener.OnLevelChanged(instrument, side, action, price, quantity);
+};
+
+// Listeners may also time the stages of every command, e.g. into
+// LatencyStats. Timestamps are only taken for listeners with this hook, so
+// the instrumentation compiles out of engines without it.
+template <typename T>
+concept LatencyListener = requires(T &listener, InstrumentId instrument,
+                                   LatencyStage stage, std::uint64_t elapsed) {
+    listener.OnStageLatency(instrument, stage, elapsed);
+};
+
+// An order about to be accepted, as handed to a RiskListener along with the
+// book's best prices (0 for an empty side). An amend replaces the resting
+// quantity of its order, which new orders leave at 0.
+struct OrderRequest {
+    AccountId account;
+    InstrumentId instrument;
+    Side side;
+    TimeInForce timeInForce;
+    OrderType type;
+    std::int64_t price;
+    std::uint32_t quantity;
+    std::int64_t bidPrice;
+    std::int64_t askPrice;
+    std::int64_t replacedPrice;
+    std::uint32_t replacedQuantity;
+};
+
+// Listeners may also gate orders with pre-trade risk checks (see
+// PreTradeRisk). CheckOrder runs after the engine's own validation and
+// before anything is recorded or matched, and an error rejects the order
+// with that message; amends that only shrink an order in place are not
+// checked. OnOrderOpened and OnOrderReduced follow every account's resting
+// quantity, so limits can be kept as counters: an order opens when it rests
+// and is reduced as it trades, is cancelled or is amended, with closed set
+// once it has left the book.
+template <typename T>
+concept RiskListener =
+    requires(T &listener, const OrderRequest &request, AccountId account,
+             std::int64_t price, std::uint32_t quantity, bool closed) {
+        {
+            listener.CheckOrder(request)
+        } -> std::same_as<std::expected<void, std::string>>;
+        listener.OnOrderOpened(account, price, quantity);
+        listener.OnOrderReduced(account, price, quantity, closed);
+    };
+
+// One order of a batch handed to BasicExchange::AddOrders
+struct BatchOrder {
+    InstrumentId instrument;
+    Side side;
+    std::int64_t price;
+    std::uint32_t quantity;
+    TimeInForce timeInForce = TimeInForce::GTC;
+    OrderType type = OrderType::LIMIT;
+    AccountId account = 0;
+};
+
+// Sizing hints for a BasicExchange, so that its containers are allocated
+// before trading starts instead of growing under load. They are not limits:
+// past them the containers grow as they otherwise would.
+struct ExchangeConfig {
+    static constexpr std::size_t kDefaultOrders = 4096;
+    static constexpr std::size_t kDefaultLevels = 256;
+    static constexpr std::size_t kDefaultMaxLadderTicks = std::size_t{1} << 20;
+
+    // Instruments registered over the exchange's lifetime
+    std::size_t instruments = 0;
+    // Orders resting at once across all books, sizes the order id index
+    std::size_t restingOrders = kDefaultOrders;
+    // Orders resting at once on one book, sizes each book's order pool
+    std::size_t ordersPerBook = kDefaultOrders;
+    // Levels on one side of a tree of levels, a price ladder preallocates
+    // its whole band instead
+    std::size_t levelsPerSide = kDefaultLevels;
+    // Unlike the hints above, a limit: the most ticks a price ladder may
+    // preallocate per side, wider bands are rejected by RegisterInstrument
+    std::size_t maxLadderTicks = kDefaultMaxLadderTicks;
+    // Have Prewarm ask for transparent huge pages for the order pools and the
+    // order id index
+    bool hugePages = false;
+};
+
+// Multi-instrument time priority limit order book matching engine
+template <ExchangeListener Listener>
+class BasicExchange {
+   public:
+    explicit BasicExchange(Listener listener = Listener{},
+                           const ExchangeConfig &config = {})
+        : m_listener(std::move(listener)),
+          m_config(config),
+          m_orderIndex(config.restingOrders)
+    {
+        m_instrumentIds.reserve(config.instruments);
+        m_books.reserve(config.instruments);
+    }
+
+    BasicExchange(const BasicExchange &) = delete;
+    BasicExchange &operator=(const BasicExchange &) = delete;
+
+    Listener &listener() { return m_listener; }
+
+    // Resolve an instrument name to its dense handle, registering the
+    // instrument on a tree of levels on first use
+    InstrumentId GetInstrumentId(const std::string &instrument);
+
+    // Register an instrument booked on a price ladder covering band instead
+    // of the default tree of levels. Orders priced outside the band or off
+    // its tick are rejected. A band wider than the config's maxLadderTicks
+    // is rejected as invalid.
+    std::expected<InstrumentId, std::string> RegisterInstrument(
+        const std::string &instrument, const PriceBand &band);
+
+    // Look up an instrument without registering it
+    std::optional<InstrumentId> findInstrument(
+        const std::string &instrument) const;
+
+    // Stays valid for the exchange's lifetime
+    const std::string &instrumentName(InstrumentId instrument) const
+    {
+        return *m_books[instrument].name;
+    }
+
+    std::size_t instrumentCount() const { return m_books.size(); }
+
+    // Band of an instrument booked on a price ladder, null for a tree of
+    // levels
+    const PriceBand *instrumentBand(InstrumentId instrument) const
+    {
+        const auto *ladder =
+            std::get_if<LadderBookT>(&m_books[instrument].levels);
+        return ladder != nullptr ? &ladder->bids.band() : nullptr;
+    }
+
+    // Call func(orderId, price, quantity, account) for the orders resting on
+    // one side of a book, best price first and in time priority within a
+    // price. Unknown instruments have no orders.
+    template <typename Func>
+    void forEachOrder(InstrumentId instrument, Side side, Func &&func) const;
+
+    // Call func(price, quantity) for the levels of one side of a book, best
+    // price first, with each level's total quantity. Unknown instruments
+    // have no levels.
+    template <typename Func>
+    void forEachLevel(InstrumentId instrument, Side side, Func &&func) const;
+
+    // Quantity resting ahead of an order at its price, i.e. what must trade
+    // before it does. The id index finds the order without searching its
+    // level, but the quantity is summed over the orders ahead of it on every
+    // call, so this is O(orders ahead) and meant for occasional queries, not
+    // for every order on every update. Keeping a running total instead would
+    // cost every fill and cancel a pass over the orders behind it.
+    // @return std::nullopt if orderId is not resting
+    std::optional<std::uint64_t> queuePosition(std::uint64_t orderId) const;
+
+    // Account a resting order was entered under, e.g. to check that a
+    // session only cancels its own orders
+    // @return std::nullopt if orderId is not resting
+    std::optional<AccountId> orderAccount(std::uint64_t orderId) const;
+
+    // Quantity of a resting order still open, e.g. to check that a restored
+    // order did not trade
+    // @return std::nullopt if orderId is not resting
+    std::optional<std::uint32_t> orderQuantity(std::uint64_t orderId) const;
+
+    // Total quantity resting on one side of a book at price or better, from
+    // the level totals alone, 0 for an unknown instrument
+    std::uint64_t depthToPrice(InstrumentId instrument, Side side,
+                               std::int64_t price) const;
+
+    // Id the next AddOrder will be given
+    std::uint64_t nextOrderId() const { return m_orderCount; }
+
+    // Order ids are drawn from one counter shared by every instrument and
+    // both sides, so an id alone identifies a resting order. IOC and market
+    // orders never book their remainder, and a fill-or-kill order is checked
+    // against the level totals before it trades, so neither allocates
+    // resting state unless it rests. A rejected order does not use up an id.
+    // Orders need a positive quantity and limit orders a price of at least
+    // 0, then go through the listener's risk checks if it has them.
+    // @return unique identifier for the order or descriptive error on failure
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity, TimeInForce timeInForce = TimeInForce::GTC,
+        OrderType type = OrderType::LIMIT, AccountId account = 0);
+
+    // Checks AddOrder makes of an order before looking at its book, for
+    // front ends that reject orders before they reach it
+    // @return success or descriptive error
+    static std::expected<void, std::string> validateOrder(
+        std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+        OrderType type)
+    {
+        if (quantity == 0) {
+            return std::unexpected("Quantity must be positive");
+        }
+        if (type == OrderType::MARKET && timeInForce == TimeInForce::GTC) {
+            return std::unexpected("Market orders must be IOC or FOK");
+        }
+        if (type == OrderType::LIMIT && price < 0) {
+            return std::unexpected("Price must not be negative");
+        }
+        return {};
+    }
+
+    // Add an order under an id chosen by the caller, for front ends that
+    // number orders themselves (see ShardedExchange). An id already resting
+    // is rejected, and AddOrder numbers on past every id accepted here.
+    std::expected<std::uint64_t, std::string> AddOrderWithId(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t price, std::uint32_t quantity,
+        TimeInForce timeInForce = TimeInForce::GTC,
+        OrderType type = OrderType::LIMIT, AccountId account = 0);
+
+    // Add a batch of orders, e.g. one quote update across several levels and
+    // instruments, as if each went through AddOrder in turn, with result i
+    // set to what AddOrder would have returned for order i. Consecutive
+    // orders on the same instrument share one book lookup, and the best
+    // prices are reported once per instrument after the whole batch, so
+    // listeners see every fill first and none of the intermediate quotes.
+    // @pre results.size() >= orders.size()
+    // @return number of orders accepted
+    std::size_t AddOrders(
+        std::span<const BatchOrder> orders,
+        std::span<std::expected<std::uint64_t, std::string>> results);
+
+    // Fails unless orderId rests on that instrument and side
+    // @return success or failure
+    bool RemoveOrder(InstrumentId instrument, Side side,
+                     std::uint64_t orderId);
+
+    // @return success or failure
+    bool RemoveOrder(std::uint64_t orderId);
+
+    // Cancel every resting order of account, e.g. when its session drops,
+    // optionally only those of one instrument or one side of it. Walks the
+    // account's own orders rather than the books, and reports each book's
+    // best price once after all its cancels.
+    // @return number of orders cancelled
+    std::size_t MassCancel(AccountId account);
+    std::size_t MassCancel(AccountId account, InstrumentId instrument);
+    std::size_t MassCancel(AccountId account, InstrumentId instrument,
+                           Side side);
+
+    // Change the price and quantity of a resting order, keeping its id.
+    // Reducing the quantity at the same price keeps its time priority; any
+    // other change re-queues it behind the orders already at its new price,
+    // trading first if that price crosses the book. An amend that changes
+    // neither is accepted without notifying anyone.
+    // @return the order's id or descriptive error on failure
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t price, std::uint32_t quantity);
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        std::uint64_t orderId, std::int64_t price, std::uint32_t quantity);
+
+    // Make AddOrder hand out ids from nextId upwards, e.g. after orders were
+    // restored from a journal. Never moves the counter back.
+    void ReserveOrderIds(std::uint64_t nextId)
+    {
+        m_orderCount = std::max(m_orderCount, nextId);
+    }
+
+    static constexpr std::size_t kDefaultCommandBatch = 64;
+
+    // Apply up to maxBatch commands queued by a gateway thread, in order.
+    // Results are not reported back: rejected adds and unknown cancels are
+    // dropped, fills and BBO changes go to the listener as usual.
+    // @return number of commands consumed from the ring
+    std::size_t ProcessCommands(CommandRing &ring,
+                                std::size_t maxBatch = kDefaultCommandBatch);
+
+    // Fault in the order pools and the order id index the config sized up
+    // front, from the calling thread, so that trading up to those sizes
+    // neither grows them nor page faults on them. Pages are placed on the
+    // NUMA node of the thread that first touches them, so call this from the
+    // matching thread once it is pinned, after registering the instruments
+    // and before the open.
+    void Prewarm();
+
+    // Write a book to std::cout from the calling thread. DumpBook hands it
+    // to a Logger's thread instead.
+    void printInstrumentBooks(const std::string &instrument) const;
+
+   private:
+    // Signed like the prices of the interface, which are validated before
+    // they reach a book
+    using PriceT = std::int64_t;
+
+    // Index into InstrumentBook::orders
+    using OrderHandle = std::uint32_t;
+    static constexpr OrderHandle kNullOrder = Pool<int>::kNull;
+
+    // FIFO of the resting orders at one price, linked through Order::next,
+    // along with their total quantity
+    struct OrderQueue {
+        PriceT price = 0;
+        std::uint32_t quantity = 0;
+        OrderHandle head = kNullOrder;
+        OrderHandle tail = kNullOrder;
+
+        bool empty() const { return head == kNullOrder; }
+    };
+
+    // What the match loop reads of a resting order as it walks a level,
+    // four to a cache line
+    struct alignas(16) Order {
+        std::uint64_t orderId;
+        std::uint32_t quantity;
+        OrderHandle next;
+    };
+
+    // The rest of it, only touched to rest, cancel, amend or find an order.
+    // The head of a queue leaves prev stale, so trading it off the front
+    // never writes here.
+    struct OrderDetail {
+        OrderQueue *queue;
+        OrderHandle prev;
+        AccountId account;
+    };
+
+    static_assert(sizeof(Order) == 16 && sizeof(OrderDetail) == 16,
+                  "keep the order records packed");
+
+    // Ids of the orders an account rested on one side of a book. Entries
+    // are not removed as those orders trade or are cancelled, which keeps
+    // the matching loop free of account bookkeeping: MassCancel skips ids
+    // that no longer rest for the account, and appending filters them out
+    // once the list doubles past its live count.
+    struct AccountOrders {
+        static constexpr std::size_t kMinCompact = 16;
+
+        std::vector<std::uint64_t> orderIds;
+        std::size_t compactAt = kMinCompact;
+    };
+
+    // Levels are stable, so OrderDetail::queue stays valid until the level
+    // is erased
+    template <template <typename, typename> typename LevelsT>
+    struct BookLevels {
+        template <typename Arg>
+        explicit BookLevels(const Arg &arg) : bids(arg), asks(arg)
+        {
+        }
+
+        LevelsT<OrderQueue, std::greater<PriceT>> bids;
+        LevelsT<OrderQueue, std::less<PriceT>> asks;
+    };
+
+    using MapBookT = BookLevels<MapLevels>;
+    using LadderBookT = BookLevels<LadderLevels>;
+
+    // Last best bid and offer reported to the listener, an empty side reads
+    // as price and quantity 0
+    struct TopOfBook {
+        PriceT bidPrice = 0;
+        std::uint32_t bidQuantity = 0;
+        PriceT askPrice = 0;
+        std::uint32_t askQuantity = 0;
+
+        bool operator==(const TopOfBook &) const = default;
+    };
+
+    // Where a resting order lives, ids are unique across all books
+    struct OrderLocation {
+        InstrumentId instrument;
+        Side side;
+        OrderHandle handle;
+    };
+
+    using OrderIndexT = FlatHashMap<uint64_t /* orderId */, OrderLocation>;
+
+    struct InstrumentBook {
+        template <typename BookT, typename Arg>
+        InstrumentBook(const std::string &bookName, std::size_t orderCapacity,
+                       std::in_place_type_t<BookT> type, const Arg &arg);
+
+        // Key in m_instrumentIds, whose nodes never move
+        const std::string *name;
+
+        SplitPool<Order, OrderDetail> orders;
+        std::variant<MapBookT, LadderBookT> levels;
+
+        FlatHashMap<std::uint32_t /* accountKey */, AccountOrders>
+            accountOrders;
+
+        TopOfBook topOfBook;
+    };
+
+    Listener m_listener;
+
+    ExchangeConfig m_config;
+
+    // Symbol registry, only consulted by the std::string lookups
+    std::unordered_map<std::string /* instrument */, InstrumentId>
+        m_instrumentIds;
+
+    // Indexed by InstrumentId
+    std::vector<InstrumentBook> m_books;
+
+    // Every resting order of every book
+    OrderIndexT m_orderIndex;
+
+    // For generating unique order IDs
+    uint64_t m_orderCount = 0;
+
+    // Timestamp of the current command's last stage boundary
+    std::uint64_t m_stageStart = 0;
+
+    // Notify the listener if the book's best bid or offer moved since it was
+    // last reported
+    template <typename BookT>
+    void updateTopOfBook(InstrumentId instrument, const BookT &levels);
+
+    // Trade an incoming order against the opposite side of levels, then
+    // rest whatever is left of it if it is a GTC limit order
+    // @return whether a remainder rested
+    template <typename BookT>
+    bool matchOrder(InstrumentId instrument, BookT &levels, Side side,
+                    std::uint64_t orderId, std::int64_t price,
+                    std::uint32_t quantity, TimeInForce timeInForce,
+                    OrderType type, AccountId account);
+
+    // Whether the opposite side of levels holds quantity at price or better
+    // (at any price for a market order), from the level totals alone
+    template <typename BookT>
+    static bool canFill(const BookT &levels, Side side, std::int64_t price,
+                        std::uint32_t quantity, OrderType type);
+
+    // Take a resting order off its side of the book, erasing its level if
+    // that empties it
+    template <typename SideLevelsT>
+    void eraseOrder(InstrumentBook &book, SideLevelsT &levels,
+                    typename OrderIndexT::iterator iter);
+
+    std::expected<std::uint64_t, std::string> addOrder(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+        OrderType type, AccountId account);
+    // Validate, record and match an order on an instrument's levels,
+    // leaving the best price report and command completion to the caller
+    template <typename BookT>
+    std::expected<std::uint64_t, std::string> addToBook(
+        InstrumentId instrument, BookT &levels, Side side,
+        std::uint64_t orderId, std::int64_t price, std::uint32_t quantity,
+        TimeInForce timeInForce, OrderType type, AccountId account);
+    void removeOrder(typename OrderIndexT::iterator iter);
+    // Cancel account's orders on one book without completing the command
+    std::size_t massCancel(AccountId account, InstrumentId instrument,
+                           std::initializer_list<Side> sides);
+    std::expected<std::uint64_t, std::string> modifyOrder(
+        typename OrderIndexT::iterator iter, std::int64_t price,
+        std::uint32_t quantity);
+
+    void notifyCommandComplete()
+    {
+        if constexpr (CommandCompleteListener<Listener>) {
+            m_listener.OnCommandComplete();
+        }
+    }
+
+    void beginStages()
+    {
+        if constexpr (LatencyListener<Listener>) {
+            m_stageStart = readTimestamp();
+        }
+    }
+
+    // Report the time since the last boundary as stage, not counting the
+    // listener call itself
+    void endStage(InstrumentId instrument, LatencyStage stage)
+    {
+        if constexpr (LatencyListener<Listener>) {
+            m_listener.OnStageLatency(instrument, stage,
+                                      readTimestamp() - m_stageStart);
+            m_stageStart = readTimestamp();
+        }
+    }
+
+    void notifyLevelChanged(InstrumentId instrument, Side side,
+                            LevelAction action, const OrderQueue &level)
+    {
+        if constexpr (LevelListener<Listener>) {
+            m_listener.OnLevelChanged(instrument, side, action, level.price,
+                                      level.quantity);
+        }
+    }
+
+    // Run the listener's risk checks on an order about to be accepted
+    std::expected<void, std::string> checkRisk(const OrderRequest &request)
+    {
+        if constexpr (RiskListener<Listener>) {
+            return m_listener.CheckOrder(request);
+        }
+        else {
+            return {};
+        }
+    }
+
+    void notifyOrderOpened(const InstrumentBook &book, OrderHandle handle,
+                           PriceT price)
+    {
+        if constexpr (RiskListener<Listener>) {
+            m_listener.OnOrderOpened(book.orders.cold(handle).account, price,
+                                     book.orders[handle].quantity);
+        }
+    }
+
+    // Only reads the order's detail for risk listeners, which keeps it out
+    // of the match loop otherwise
+    void notifyOrderReduced(const InstrumentBook &book, OrderHandle handle,
+                            PriceT price, std::uint32_t quantity, bool closed)
+    {
+        if constexpr (RiskListener<Listener>) {
+            m_listener.OnOrderReduced(book.orders.cold(handle).account, price,
+                                      quantity, closed);
+        }
+    }
+
+    // Append to the back of the order's queue (time priority)
+    static void enqueueOrder(InstrumentBook &book, OrderHandle handle);
+    static void unlinkOrder(InstrumentBook &book, OrderHandle handle);
+
+    static std::uint32_t accountKey(AccountId account, Side side)
+    {
+        return std::uint32_t{account} << 1 | static_cast<std::uint32_t>(side);
+    }
+
+    // Index entry of orderId if it rests on side of instrument for account
+    typename OrderIndexT::iterator findAccountOrder(std::uint64_t orderId,
+                                                    InstrumentId instrument,
+                                                    Side side,
+                                                    AccountId account);
+
+    // Add a newly rested order to its account's list
+    void addAccountOrder(InstrumentId instrument, Side side, AccountId account,
+                         std::uint64_t orderId);
+};
+
+template <ExchangeListener Listener>
+template <typename BookT, typename Arg>
+BasicExchange<Listener>::InstrumentBook::InstrumentBook(
+    const std::string &bookName, std::size_t orderCapacity,
+    std::in_place_type_t<BookT> type, const Arg &arg)
+    : name(&bookName), orders(orderCapacity), levels(type, arg)
+{
+}
+
+template <ExchangeListener Listener>
+template <typename BookT>
+void BasicExchange<Listener>::updateTopOfBook(InstrumentId instrument,
+                                              const BookT &levels)
+{
+    InstrumentBook &book = m_books[instrument];
+    TopOfBook top;
+    if (const OrderQueue *best_bid = levels.bids.best()) {
+        top.bidPrice = best_bid->price;
+        top.bidQuantity = best_bid->quantity;
+    }
+    if (const OrderQueue *best_ask = levels.asks.best()) {
+        top.askPrice = best_ask->price;
+        top.askQuantity = best_ask->quantity;
+    }
+    if (top == book.topOfBook) {
+        return;
+    }
+    book.topOfBook = top;
+    m_listener.OnBestPriceChanged(instrument, top.bidPrice, top.bidQuantity,
+                                  top.askPrice, top.askQuantity);
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::enqueueOrder(InstrumentBook &book,
+                                           OrderHandle handle)
+{
+    Order &order = book.orders[handle];
+    OrderQueue &queue = *book.orders.cold(handle).queue;
+    book.orders.cold(handle).prev = queue.tail;
+    order.next = kNullOrder;
+    if (queue.tail != kNullOrder) {
+        book.orders[queue.tail].next = handle;
+    }
+    else {
+        queue.head = handle;
+    }
+    queue.tail = handle;
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::unlinkOrder(InstrumentBook &book,
+                                          OrderHandle handle)
+{
+    const Order &order = book.orders[handle];
+    const OrderDetail &detail = book.orders.cold(handle);
+    OrderQueue &queue = *detail.queue;
+    if (handle == queue.head) {
+        queue.head = order.next;
+    }
+    else {
+        book.orders[detail.prev].next = order.next;
+    }
+    if (order.next != kNullOrder) {
+        book.orders.cold(order.next).prev = detail.prev;
+    }
+    else {
+        queue.tail = queue.head == kNullOrder ? kNullOrder : detail.prev;
+    }
+}
+
+template <ExchangeListener Listener>
+typename BasicExchange<Listener>::OrderIndexT::iterator
+BasicExchange<Listener>::findAccountOrder(std::uint64_t orderId,
+                                          InstrumentId instrument, Side side,
+                                          AccountId account)
+{
+    // Lists keep ids that traded, were cancelled or were reused since
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end() || iter->second.instrument != instrument ||
+        iter->second.side != side ||
+        m_books[instrument].orders.cold(iter->second.handle).account !=
+            account) {
+        return m_orderIndex.end();
+    }
+    return iter;
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::addAccountOrder(InstrumentId instrument,
+                                              Side side, AccountId account,
+                                              std::uint64_t orderId)
+{
+    auto &accountOrders = m_books[instrument].accountOrders;
+    AccountOrders &list =
+        accountOrders.try_emplace(accountKey(account, side)).first->second;
+    if (list.orderIds.size() >= list.compactAt) {
+        std::erase_if(list.orderIds, [&](std::uint64_t listed) {
+            return findAccountOrder(listed, instrument, side, account) ==
+                   m_orderIndex.end();
+        });
+        list.compactAt =
+            std::max(AccountOrders::kMinCompact, 2 * list.orderIds.size());
+    }
+    list.orderIds.push_back(orderId);
+}
+
+template <ExchangeListener Listener>
+template <typename BookT>
+bool BasicExchange<Listener>::matchOrder(InstrumentId instrument,
+                                         BookT &levels, Side side,
+                                         std::uint64_t orderId,
+                                         std::int64_t price,
+                                         std::uint32_t quantity,
+                                         TimeInForce timeInForce,
+                                         OrderType type, AccountId account)
+{
+    auto &book = m_books[instrument];
+    bool market = type == OrderType::MARKET;
+    Side oppositeSide = side == Side::BUY ? Side::SELL : Side::BUY;
+
+    auto process_orders = [&](auto &targetLevels, auto &oppositeLevels,
+                              auto &&priceMatch) {
+        // A filled aggressor stops before looking at the next level
+        while (quantity > 0) {
+            OrderQueue *level = oppositeLevels.best();
+            if (level == nullptr ||
+                (!market && !priceMatch(level->price, price))) {
+                break;
+            }
+            // The whole level trades: settle it from its cached total and
+            // release its orders in one pass without relinking neighbours
+            if (quantity >= level->quantity) {
+                quantity -= level->quantity;
+                OrderHandle handle = level->head;
+                while (handle != kNullOrder) {
+                    const Order &order = book.orders[handle];
+                    m_listener.OnOrderTraded(instrument, order.orderId,
+                                             level->price, order.quantity);
+                    notifyOrderReduced(book, handle, level->price,
+                                       order.quantity, true);
+                    m_orderIndex.erase(order.orderId);
+                    OrderHandle next = order.next;
+                    book.orders.release(handle);
+                    handle = next;
+                }
+                level->quantity = 0;
+                level->head = kNullOrder;
+                level->tail = kNullOrder;
+                notifyLevelChanged(instrument, oppositeSide,
+                                   LevelAction::DELETE, *level);
+                oppositeLevels.erase(*level);
+                continue;
+            }
+            // The level outlasts the aggressor, so it never runs out of
+            // orders here and only its head is unlinked
+            level->quantity -= quantity;
+            while (quantity > 0) {
+                OrderHandle handle = level->head;
+                Order &order = book.orders[handle];
+                // Full trade
+                if (order.quantity <= quantity) {
+                    m_listener.OnOrderTraded(instrument, order.orderId,
+                                             level->price, order.quantity);
+                    notifyOrderReduced(book, handle, level->price,
+                                       order.quantity, true);
+                    quantity -= order.quantity;
+                    m_orderIndex.erase(order.orderId);
+                    level->head = order.next;
+                    book.orders.release(handle);
+                }
+                // Partial trade
+                else {
+                    m_listener.OnOrderTraded(instrument, order.orderId,
+                                             level->price, quantity);
+                    notifyOrderReduced(book, handle, level->price, quantity,
+                                       false);
+                    order.quantity -= quantity;
+                    quantity = 0;
+                }
+            }
+            notifyLevelChanged(instrument, oppositeSide, LevelAction::CHANGE,
+                               *level);
+        }
+        endStage(instrument, LatencyStage::MATCH);
+        if (quantity > 0 && timeInForce == TimeInForce::GTC) {
+            // Every entry point rejects or never hands out a resting id
+            assert(!m_orderIndex.contains(orderId));
+            OrderQueue &level = targetLevels.findOrCreate(price);
+            OrderHandle handle = book.orders.allocate(
+                Order{orderId, quantity, kNullOrder},
+                OrderDetail{&level, kNullOrder, account});
+            enqueueOrder(book, handle);
+            notifyOrderOpened(book, handle, level.price);
+            m_orderIndex.try_emplace(orderId,
+                                     OrderLocation{instrument, side, handle});
+            // An empty level was either just created or erased earlier
+            LevelAction action =
+                level.quantity == 0 ? LevelAction::ADD : LevelAction::CHANGE;
+            level.quantity += quantity;
+            notifyLevelChanged(instrument, side, action, level);
+            endStage(instrument, LatencyStage::REST);
+            return true;
+        }
+        return false;
+    };
+
+    if (side == Side::BUY) {
+        return process_orders(levels.bids, levels.asks,
+                              std::less_equal<PriceT>{});
+    }
+    return process_orders(levels.asks, levels.bids,
+                          std::greater_equal<PriceT>{});
+}
+
+template <ExchangeListener Listener>
+template <typename BookT>
+bool BasicExchange<Listener>::canFill(const BookT &levels, Side side,
+                                      std::int64_t price,
+                                      std::uint32_t quantity, OrderType type)
+{
+    std::uint64_t available = 0;
+    auto sum_levels = [&](const auto &oppositeLevels, auto &&priceMatch) {
+        oppositeLevels.forEachWhile([&](const OrderQueue &level) {
+            if (type != OrderType::MARKET && !priceMatch(level.price, price)) {
+                return false;
+            }
+            available += level.quantity;
+            return available < quantity;
+        });
+    };
+    if (side == Side::BUY) {
+        sum_levels(levels.asks, std::less_equal<PriceT>{});
+    }
+    else {
+        sum_levels(levels.bids, std::greater_equal<PriceT>{});
+    }
+    return available >= quantity;
+}
+
+template <ExchangeListener Listener>
+template <typename SideLevelsT>
+void BasicExchange<Listener>::eraseOrder(InstrumentBook &book,
+                                         SideLevelsT &levels,
+                                         typename OrderIndexT::iterator iter)
+{
+    OrderLocation location = iter->second;
+    const Order &order = book.orders[location.handle];
+    OrderQueue *queue = book.orders.cold(location.handle).queue;
+    queue->quantity -= order.quantity;
+    notifyOrderReduced(book, location.handle, queue->price, order.quantity,
+                       true);
+    m_orderIndex.erase(iter);
+    unlinkOrder(book, location.handle);
+    book.orders.release(location.handle);
+    if (queue->empty()) {
+        notifyLevelChanged(location.instrument, location.side,
+                           LevelAction::DELETE, *queue);
+        levels.erase(*queue);
+    }
+    else {
+        notifyLevelChanged(location.instrument, location.side,
+                           LevelAction::CHANGE, *queue);
+    }
+}
+
+template <ExchangeListener Listener>
+InstrumentId BasicExchange<Listener>::GetInstrumentId(
+    const std::string &instrument)
+{
+    auto [iter, inserted] = m_instrumentIds.try_emplace(
+        instrument, static_cast<InstrumentId>(m_books.size()));
+    if (inserted) {
+        m_books.emplace_back(iter->first, m_config.ordersPerBook,
+                             std::in_place_type<MapBookT>,
+                             m_config.levelsPerSide);
+        if constexpr (CommandRecorder<Listener>) {
+            m_listener.OnInstrumentRegistered(iter->second, iter->first,
+                                              nullptr);
+        }
+    }
+    return iter->second;
+}
+
+template <ExchangeListener Listener>
+std::expected<InstrumentId, std::string>
+BasicExchange<Listener>::RegisterInstrument(const std::string &instrument,
+                                            const PriceBand &band)
+{
+    if (band.tickSize <= 0 || band.minPrice < 0 ||
+        band.maxPrice < band.minPrice ||
+        (band.maxPrice - band.minPrice) % band.tickSize != 0 ||
+        static_cast<std::uint64_t>(band.maxPrice - band.minPrice) /
+                static_cast<std::uint64_t>(band.tickSize) >=
+            m_config.maxLadderTicks) {
+        return std::unexpected("Invalid price band");
+    }
+    auto [iter, inserted] = m_instrumentIds.try_emplace(
+        instrument, static_cast<InstrumentId>(m_books.size()));
+    if (!inserted) {
+        return std::unexpected("Instrument already registered");
+    }
+    // The book keeps a pointer to the name's key, so the name goes in first
+    // and comes out again if the book cannot be allocated
+    try {
+        m_books.emplace_back(iter->first, m_config.ordersPerBook,
+                             std::in_place_type<LadderBookT>, band);
+    }
+    catch (...) {
+        m_instrumentIds.erase(iter);
+        throw;
+    }
+    if constexpr (CommandRecorder<Listener>) {
+        m_listener.OnInstrumentRegistered(iter->second, iter->first, &band);
+    }
+    return iter->second;
+}
+
+template <ExchangeListener Listener>
+std::optional<InstrumentId> BasicExchange<Listener>::findInstrument(
+    const std::string &instrument) const
+{
+    auto iter = m_instrumentIds.find(instrument);
+    if (iter == m_instrumentIds.end()) {
+        return std::nullopt;
+    }
+    return iter->second;
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity, TimeInForce timeInForce, OrderType type,
+    AccountId account)
+{
+    beginStages();
+    auto result = addOrder(instrument, side, m_orderCount, price, quantity,
+                           timeInForce, type, account);
+    if (result) {
+        ++m_orderCount;
+    }
+    return result;
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string>
+BasicExchange<Listener>::AddOrderWithId(InstrumentId instrument, Side side,
+                                        std::uint64_t orderId,
+                                        std::int64_t price,
+                                        std::uint32_t quantity,
+                                        TimeInForce timeInForce,
+                                        OrderType type, AccountId account)
+{
+    beginStages();
+    if (m_orderIndex.contains(orderId)) {
+        return std::unexpected("Duplicate order id");
+    }
+    auto result = addOrder(instrument, side, orderId, price, quantity,
+                           timeInForce, type, account);
+    // AddOrder must never hand out an id this order may still rest under
+    if (result) {
+        ReserveOrderIds(orderId + 1);
+    }
+    return result;
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::addOrder(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+    OrderType type, AccountId account)
+{
+    if (instrument >= m_books.size()) {
+        return std::unexpected("Unknown instrument");
+    }
+    auto result = std::visit(
+        [&](auto &levels) {
+            auto added = addToBook(instrument, levels, side, orderId, price,
+                                   quantity, timeInForce, type, account);
+            if (added) {
+                updateTopOfBook(instrument, levels);
+            }
+            return added;
+        },
+        m_books[instrument].levels);
+    notifyCommandComplete();
+    if (result) {
+        endStage(instrument, LatencyStage::DISPATCH);
+    }
+    return result;
+}
+
+template <ExchangeListener Listener>
+template <typename BookT>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::addToBook(
+    InstrumentId instrument, BookT &levels, Side side, std::uint64_t orderId,
+    std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+    OrderType type, AccountId account)
+{
+    if (auto valid = validateOrder(price, quantity, timeInForce, type);
+        !valid) {
+        return std::unexpected(std::move(valid.error()));
+    }
+    if (type == OrderType::LIMIT && !levels.bids.accepts(price)) {
+        return std::unexpected("Price outside instrument's price band");
+    }
+    // The levels rather than the last reported quote, which lags behind
+    // them inside a batch
+    auto best_price = [](const auto &sideLevels) -> std::int64_t {
+        const OrderQueue *best = sideLevels.best();
+        return best == nullptr ? 0 : best->price;
+    };
+    // Ahead of the fill-or-kill check, which walks the book
+    auto risk = checkRisk({account, instrument, side, timeInForce, type,
+                           price, quantity, best_price(levels.bids),
+                           best_price(levels.asks), 0, 0});
+    if (!risk) {
+        return std::unexpected(std::move(risk.error()));
+    }
+    if (timeInForce == TimeInForce::FOK &&
+        !canFill(levels, side, price, quantity, type)) {
+        return std::unexpected("Fill-or-kill order cannot fill");
+    }
+    if constexpr (CommandRecorder<Listener>) {
+        m_listener.OnOrderAccepted(instrument, side, orderId, price, quantity,
+                                   timeInForce, type, account);
+    }
+    endStage(instrument, LatencyStage::LOOKUP);
+    if (matchOrder(instrument, levels, side, orderId, price, quantity,
+                   timeInForce, type, account)) {
+        // Listed once when it first rests, amends keep that entry
+        addAccountOrder(instrument, side, account, orderId);
+    }
+    return orderId;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::AddOrders(
+    std::span<const BatchOrder> orders,
+    std::span<std::expected<std::uint64_t, std::string>> results)
+{
+    beginStages();
+    std::size_t accepted = 0;
+    // Each run of orders on one instrument is matched with its book
+    // resolved once
+    for (std::size_t first = 0, last = 0; first < orders.size();
+         first = last) {
+        InstrumentId instrument = orders[first].instrument;
+        last = first + 1;
+        while (last < orders.size() && orders[last].instrument == instrument) {
+            ++last;
+        }
+        if (instrument >= m_books.size()) {
+            for (std::size_t i = first; i < last; ++i) {
+                results[i] = std::unexpected("Unknown instrument");
+            }
+            continue;
+        }
+        std::visit(
+            [&](auto &levels) {
+                for (std::size_t i = first; i < last; ++i) {
+                    const BatchOrder &order = orders[i];
+                    results[i] = addToBook(
+                        instrument, levels, order.side, m_orderCount,
+                        order.price, order.quantity, order.timeInForce,
+                        order.type, order.account);
+                    if (results[i]) {
+                        ++m_orderCount;
+                        ++accepted;
+                    }
+                }
+            },
+            m_books[instrument].levels);
+    }
+    // Once per run, which reports nothing for a book whose quote is already
+    // up to date, so an instrument split across runs is still reported once
+    for (std::size_t i = 0; i < orders.size(); ++i) {
+        InstrumentId instrument = orders[i].instrument;
+        if ((i != 0 && orders[i - 1].instrument == instrument) ||
+            instrument >= m_books.size()) {
+            continue;
+        }
+        std::visit(
+            [&](const auto &levels) { updateTopOfBook(instrument, levels); },
+            m_books[instrument].levels);
+    }
+    notifyCommandComplete();
+    return accepted;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::ProcessCommands(CommandRing &ring,
+                                                     std::size_t maxBatch)
+{
+    return ring.popBatch(
+        [this](const OrderCommand &command) {
+            switch (command.type) {
+                case OrderCommand::Type::ADD:
+                    AddOrderWithId(command.instrument, command.side,
+                                   command.orderId, command.price,
+                                   command.quantity, command.timeInForce,
+                                   command.orderType, command.account);
+                    break;
+                case OrderCommand::Type::CANCEL:
+                    RemoveOrder(command.instrument, command.side,
+                                command.orderId);
+                    break;
+                case OrderCommand::Type::MODIFY:
+                    ModifyOrder(command.instrument, command.side,
+                                command.orderId, command.price,
+                                command.quantity);
+                    break;
+            }
+        },
+        maxBatch);
+}
+
+template <ExchangeListener Listener>
+bool BasicExchange<Listener>::RemoveOrder(InstrumentId instrument, Side side,
+                                          std::uint64_t orderId)
+{
+    beginStages();
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end() || iter->second.instrument != instrument ||
+        iter->second.side != side) {
+        return false;
+    }
+    removeOrder(iter);
+    return true;
+}
+
+template <ExchangeListener Listener>
+bool BasicExchange<Listener>::RemoveOrder(std::uint64_t orderId)
+{
+    beginStages();
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end()) {
+        return false;
+    }
+    removeOrder(iter);
+    return true;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::MassCancel(AccountId account)
+{
+    beginStages();
+    std::size_t cancelled = 0;
+    for (InstrumentId instrument = 0; instrument < m_books.size();
+         ++instrument) {
+        cancelled +=
+            massCancel(account, instrument, {Side::BUY, Side::SELL});
+    }
+    notifyCommandComplete();
+    return cancelled;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::MassCancel(AccountId account,
+                                                InstrumentId instrument)
+{
+    beginStages();
+    if (instrument >= m_books.size()) {
+        return 0;
+    }
+    std::size_t cancelled =
+        massCancel(account, instrument, {Side::BUY, Side::SELL});
+    notifyCommandComplete();
+    return cancelled;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::MassCancel(AccountId account,
+                                                InstrumentId instrument,
+                                                Side side)
+{
+    beginStages();
+    if (instrument >= m_books.size()) {
+        return 0;
+    }
+    std::size_t cancelled = massCancel(account, instrument, {side});
+    notifyCommandComplete();
+    return cancelled;
+}
+
+template <ExchangeListener Listener>
+std::size_t BasicExchange<Listener>::massCancel(
+    AccountId account, InstrumentId instrument,
+    std::initializer_list<Side> sides)
+{
+    auto &book = m_books[instrument];
+    std::size_t cancelled = 0;
+    std::visit(
+        [&](auto &levels) {
+            for (Side side : sides) {
+                auto entry =
+                    book.accountOrders.find(accountKey(account, side));
+                if (entry == book.accountOrders.end()) {
+                    continue;
+                }
+                std::vector<std::uint64_t> orderIds =
+                    std::move(entry->second.orderIds);
+                book.accountOrders.erase(entry);
+                for (std::uint64_t orderId : orderIds) {
+                    auto iter =
+                        findAccountOrder(orderId, instrument, side, account);
+                    if (iter == m_orderIndex.end()) {
+                        continue;
+                    }
+                    if (side == Side::BUY) {
+                        eraseOrder(book, levels.bids, iter);
+                    }
+                    else {
+                        eraseOrder(book, levels.asks, iter);
+                    }
+                    if constexpr (CommandRecorder<Listener>) {
+                        m_listener.OnOrderCancelled(instrument, side, orderId);
+                    }
+                    ++cancelled;
+                }
+            }
+            if (cancelled != 0) {
+                endStage(instrument, LatencyStage::CANCEL);
+                updateTopOfBook(instrument, levels);
+            }
+        },
+        book.levels);
+    return cancelled;
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::removeOrder(typename OrderIndexT::iterator iter)
+{
+    std::uint64_t orderId = iter->first;
+    OrderLocation location = iter->second;
+    endStage(location.instrument, LatencyStage::LOOKUP);
+    auto &book = m_books[location.instrument];
+    std::visit(
+        [&](auto &levels) {
+            if (location.side == Side::BUY) {
+                eraseOrder(book, levels.bids, iter);
+            }
+            else {
+                eraseOrder(book, levels.asks, iter);
+            }
+            endStage(location.instrument, LatencyStage::CANCEL);
+            if constexpr (CommandRecorder<Listener>) {
+                m_listener.OnOrderCancelled(location.instrument,
+                                            location.side, orderId);
+            }
+            updateTopOfBook(location.instrument, levels);
+        },
+        book.levels);
+    notifyCommandComplete();
+    endStage(location.instrument, LatencyStage::DISPATCH);
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::ModifyOrder(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t price, std::uint32_t quantity)
+{
+    beginStages();
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end() || iter->second.instrument != instrument ||
+        iter->second.side != side) {
+        return std::unexpected("Unknown order");
+    }
+    return modifyOrder(iter, price, quantity);
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::ModifyOrder(
+    std::uint64_t orderId, std::int64_t price, std::uint32_t quantity)
+{
+    beginStages();
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end()) {
+        return std::unexpected("Unknown order");
+    }
+    return modifyOrder(iter, price, quantity);
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> BasicExchange<Listener>::modifyOrder(
+    typename OrderIndexT::iterator iter, std::int64_t price,
+    std::uint32_t quantity)
+{
+    if (quantity == 0) {
+        return std::unexpected("Quantity must be positive");
+    }
+    if (price < 0) {
+        return std::unexpected("Price must not be negative");
+    }
+    std::uint64_t orderId = iter->first;
+    OrderLocation location = iter->second;
+    auto &book = m_books[location.instrument];
+    if (book.orders.cold(location.handle).queue->price == price &&
+        book.orders[location.handle].quantity == quantity) {
+        return orderId;
+    }
+
+    auto modify_order =
+        [&](auto &levels) -> std::expected<std::uint64_t, std::string> {
+        if (!levels.bids.accepts(price)) {
+            return std::unexpected("Price outside instrument's price band");
+        }
+        Order &order = book.orders[location.handle];
+        const OrderDetail &detail = book.orders.cold(location.handle);
+        OrderQueue &queue = *detail.queue;
+        bool shrink = queue.price == price && quantity < order.quantity;
+        // Shrinking only lowers the account's exposure
+        if (!shrink) {
+            auto risk = checkRisk(
+                {detail.account, location.instrument, location.side,
+                 TimeInForce::GTC, OrderType::LIMIT, price, quantity,
+                 book.topOfBook.bidPrice, book.topOfBook.askPrice,
+                 queue.price, order.quantity});
+            if (!risk) {
+                return std::unexpected(std::move(risk.error()));
+            }
+        }
+        if constexpr (CommandRecorder<Listener>) {
+            m_listener.OnOrderModified(location.instrument, location.side,
+                                       orderId, price, quantity);
+        }
+        endStage(location.instrument, LatencyStage::LOOKUP);
+        if (shrink) {
+            // Shrinking in place keeps the order's place in the queue
+            notifyOrderReduced(book, location.handle, queue.price,
+                               order.quantity - quantity, false);
+            queue.quantity -= order.quantity - quantity;
+            order.quantity = quantity;
+            notifyLevelChanged(location.instrument, location.side,
+                               LevelAction::CHANGE, queue);
+            endStage(location.instrument, LatencyStage::REST);
+        }
+        else {
+            // Otherwise it goes to the back of its new level, trading first
+            // if the new price crosses
+            AccountId account = detail.account;
+            if (location.side == Side::BUY) {
+                eraseOrder(book, levels.bids, iter);
+            }
+            else {
+                eraseOrder(book, levels.asks, iter);
+            }
+            endStage(location.instrument, LatencyStage::CANCEL);
+            matchOrder(location.instrument, levels, location.side, orderId,
+                       price, quantity, TimeInForce::GTC, OrderType::LIMIT,
+                       account);
+        }
+        updateTopOfBook(location.instrument, levels);
+        return orderId;
+    };
+
+    auto result = std::visit(modify_order, book.levels);
+    notifyCommandComplete();
+    if (result) {
+        endStage(location.instrument, LatencyStage::DISPATCH);
+    }
+    return result;
+}
+
+template <ExchangeListener Listener>
+template <typename Func>
+void BasicExchange<Listener>::forEachOrder(InstrumentId instrument, Side side,
+                                           Func &&func) const
+{
+    if (instrument >= m_books.size()) {
+        return;
+    }
+    const InstrumentBook &book = m_books[instrument];
+    auto visitLevels = [&](const auto &sideLevels) {
+        sideLevels.forEach([&](const OrderQueue &level) {
+            for (OrderHandle handle = level.head; handle != kNullOrder;
+                 handle = book.orders[handle].next) {
+                const Order &order = book.orders[handle];
+                func(order.orderId, level.price, order.quantity,
+                     book.orders.cold(handle).account);
+            }
+        });
+    };
+    std::visit(
+        [&](const auto &levels) {
+            if (side == Side::BUY) {
+                visitLevels(levels.bids);
+            }
+            else {
+                visitLevels(levels.asks);
+            }
+        },
+        book.levels);
+}
+
+template <ExchangeListener Listener>
+template <typename Func>
+void BasicExchange<Listener>::forEachLevel(InstrumentId instrument, Side side,
+                                           Func &&func) const
+{
+    if (instrument >= m_books.size()) {
+        return;
+    }
+    auto visitLevels = [&](const auto &sideLevels) {
+        sideLevels.forEach([&](const OrderQueue &level) {
+            func(level.price, level.quantity);
+        });
+    };
+    std::visit(
+        [&](const auto &levels) {
+            if (side == Side::BUY) {
+                visitLevels(levels.bids);
+            }
+            else {
+                visitLevels(levels.asks);
+            }
+        },
+        m_books[instrument].levels);
+}
+
+template <ExchangeListener Listener>
+std::optional<std::uint64_t> BasicExchange<Listener>::queuePosition(
+    std::uint64_t orderId) const
+{
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end()) {
+        return std::nullopt;
+    }
+    const InstrumentBook &book = m_books[iter->second.instrument];
+    OrderHandle head = book.orders.cold(iter->second.handle).queue->head;
+    std::uint64_t ahead = 0;
+    // The head's prev is stale
+    for (OrderHandle handle = iter->second.handle; handle != head;) {
+        handle = book.orders.cold(handle).prev;
+        ahead += book.orders[handle].quantity;
+    }
+    return ahead;
+}
+
+template <ExchangeListener Listener>
+std::optional<AccountId> BasicExchange<Listener>::orderAccount(
+    std::uint64_t orderId) const
+{
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end()) {
+        return std::nullopt;
+    }
+    return m_books[iter->second.instrument]
+        .orders.cold(iter->second.handle)
+        .account;
+}
+
+template <ExchangeListener Listener>
+std::optional<std::uint32_t> BasicExchange<Listener>::orderQuantity(
+    std::uint64_t orderId) const
+{
+    auto iter = m_orderIndex.find(orderId);
+    if (iter == m_orderIndex.end()) {
+        return std::nullopt;
+    }
+    return m_books[iter->second.instrument]
+        .orders[iter->second.handle]
+        .quantity;
+}
+
+template <ExchangeListener Listener>
+std::uint64_t BasicExchange<Listener>::depthToPrice(InstrumentId instrument,
+                                                    Side side,
+                                                    std::int64_t price) const
+{
+    if (instrument >= m_books.size()) {
+        return 0;
+    }
+    std::uint64_t depth = 0;
+    auto sum_levels = [&](const auto &sideLevels, auto &&priceMatch) {
+        sideLevels.forEachWhile([&](const OrderQueue &level) {
+            if (!priceMatch(level.price, price)) {
+                return false;
+            }
+            depth += level.quantity;
+            return true;
+        });
+    };
+    std::visit(
+        [&](const auto &levels) {
+            if (side == Side::BUY) {
+                sum_levels(levels.bids, std::greater_equal<PriceT>{});
+            }
+            else {
+                sum_levels(levels.asks, std::less_equal<PriceT>{});
+            }
+        },
+        m_books[instrument].levels);
+    return depth;
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::Prewarm()
+{
+    m_orderIndex.prewarm(m_config.hugePages);
+    for (InstrumentBook &book : m_books) {
+        book.orders.prewarm(m_config.hugePages);
+    }
+}
+
+template <ExchangeListener Listener>
+void BasicExchange<Listener>::printInstrumentBooks(
+    const std::string &instrument) const
+{
+    std::cout << "Instrument=" << instrument << "\n";
+    auto id = findInstrument(instrument);
+    if (!id) {
+        return;
+    }
+    const auto &book = m_books[*id];
+    auto printPriceLevel = [&](const auto &price_levels) {
+        price_levels.forEach([&](const OrderQueue &level) {
+            std::cout << "Price=" << level.price << "\n";
+            for (OrderHandle handle = level.head; handle != kNullOrder;
+                 handle = book.orders[handle].next) {
+                const Order &order = book.orders[handle];
+                std::cout << "{id=" << order.orderId
+                          << ", quantity=" << order.quantity << "} ";
+            }
+            std::cout << "\n";
+        });
+    };
+    std::visit(
+        [&](const auto &levels) {
+            std::cout << "-----------------------------\n";
+            std::cout << "Bids:\n";
+            printPriceLevel(levels.bids);
+            std::cout << "-----------------------------\n";
+            std::cout << "Asks:\n";
+            printPriceLevel(levels.asks);
+        },
+        book.levels);
+}
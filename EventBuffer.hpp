@@ -0,0 +1,118 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "IExchange.hpp"
+
+// One matching event, as recorded by an EventBuffer
+struct ExchangeEvent {
+    enum class Type : std::uint8_t { ORDER_TRADED, BEST_PRICE_CHANGED };
+
+    Type type;
+    InstrumentId instrument;
+    std::uint64_t orderId;  // ORDER_TRADED only
+    // Traded price and quantity, or the bid side of a BBO update
+    std::int64_t price;
+    std::uint32_t quantity;
+    std::uint32_t askQuantity;
+    std::int64_t askPrice;
+};
+
+// Contiguous record of matching events. Capacity is reserved up front, so
+// recording only allocates if a single flush interval outgrows it.
+class EventBuffer {
+   public:
+    static constexpr std::size_t kDefaultCapacity = 1024;
+
+    explicit EventBuffer(std::size_t capacity = kDefaultCapacity)
+    {
+        m_events.reserve(capacity);
+    }
+
+    void recordTrade(InstrumentId instrument, std::uint64_t orderId,
+                     std::int64_t tradedPrice, std::uint32_t tradedQuantity)
+    {
+        m_events.push_back(ExchangeEvent{ExchangeEvent::Type::ORDER_TRADED,
+                                         instrument, orderId, tradedPrice,
+                                         tradedQuantity, 0, 0});
+    }
+
+    void recordBestPrice(InstrumentId instrument, std::int64_t bidPrice,
+                         std::uint32_t bidTotalQuantity, std::int64_t askPrice,
+                         std::uint32_t askTotalQuantity)
+    {
+        m_events.push_back(
+            ExchangeEvent{ExchangeEvent::Type::BEST_PRICE_CHANGED, instrument,
+                          0, bidPrice, bidTotalQuantity, askTotalQuantity,
+                          askPrice});
+    }
+
+    std::span<const ExchangeEvent> events() const { return m_events; }
+
+    bool empty() const { return m_events.empty(); }
+
+    void clear() { m_events.clear(); }
+
+   private:
+    std::vector<ExchangeEvent> m_events;
+};
+
+// BasicExchange listener that records events while an order is matched and
+// hands them to sink as one span afterwards, keeping user code out of the
+// match loop. With flushPerCommand the buffer is flushed after every add or
+// cancel; otherwise call flush(), e.g. once per ProcessCommands batch.
+template <typename Sink>
+    requires std::invocable<Sink &, std::span<const ExchangeEvent>>
+class BufferedListener {
+   public:
+    explicit BufferedListener(
+        Sink sink, bool flushPerCommand = true,
+        std::size_t capacity = EventBuffer::kDefaultCapacity)
+        : m_sink(std::move(sink)),
+          m_flushPerCommand(flushPerCommand),
+          m_buffer(capacity)
+    {
+    }
+
+    void OnOrderTraded(InstrumentId instrument, std::uint64_t orderId,
+                       std::int64_t tradedPrice, std::uint32_t tradedQuantity)
+    {
+        m_buffer.recordTrade(instrument, orderId, tradedPrice, tradedQuantity);
+    }
+
+    void OnBestPriceChanged(InstrumentId instrument, std::int64_t bidPrice,
+                            std::uint32_t bidTotalQuantity,
+                            std::int64_t askPrice,
+                            std::uint32_t askTotalQuantity)
+    {
+        m_buffer.recordBestPrice(instrument, bidPrice, bidTotalQuantity,
+                                 askPrice, askTotalQuantity);
+    }
+
+    void OnCommandComplete()
+    {
+        if (m_flushPerCommand) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (!m_buffer.empty()) {
+            m_sink(m_buffer.events());
+            m_buffer.clear();
+        }
+    }
+
+    Sink &sink() { return m_sink; }
+
+   private:
+    Sink m_sink;
+    bool m_flushPerCommand;
+    EventBuffer m_buffer;
+};
@@ -11,8 +11,9 @@ return an error.
 
 /*
 AddOrder error cases:
-    1) Price is negative
-    1) Quantity is <= 0
+    1) Price of a limit order is negative
+    2) Quantity is 0
+    3) An attached PreTradeRisk rejects it
 RemoveOrder error cases:
     1) orderId doesn't exist
  */
@@ -21,289 +22,302 @@ RemoveOrder error cases:
 Assumptions:
     * Number of orders won't exceed 2^64-1
     * New instruments get added to both sides
-    * Order only trades if it trades completely (sufficient quantity)
+    * Orders trade partially and rest their remainder unless they are IOC,
+      FOK (trade completely or not at all) or market orders
  */
 
-#include <cassert>
-#include <deque>
-#include <functional>
-#include <iostream>
-#include <map>
-#include <string>
-#include <unordered_map>
+#include "Exchange.hpp"
 
-#include "IExchange.hpp"
+#include <utility>
 
-class Exchange : public IExchange {
-   public:
-    Exchange() {}
-
-    ~Exchange() override = default;
-
-    std::expected<std::uint64_t, std::string> AddOrder(
-        const std::string &instrument, Side side, std::int64_t price,
-        std::uint32_t quantity) override;
+void Exchange::CallbackListener::OnOrderTraded(InstrumentId instrument,
+                                               std::uint64_t orderId,
+                                               std::int64_t tradedPrice,
+                                               std::uint32_t tradedQuantity)
+{
+    if (replaying) {
+        return;
+    }
+    if (batching) {
+        buffer.recordTrade(instrument, orderId, tradedPrice, tradedQuantity);
+    }
+    else if (exchange->OrderTraded) {
+        exchange->OrderTraded(exchange->m_engine.instrumentName(instrument),
+                              orderId, tradedPrice, tradedQuantity);
+    }
+}
 
-    bool RemoveOrder(const std::string &instrument, Side side,
-                     std::uint64_t orderId) override;
+void Exchange::CallbackListener::OnBestPriceChanged(
+    InstrumentId instrument, std::int64_t bidPrice,
+    std::uint32_t bidTotalQuantity, std::int64_t askPrice,
+    std::uint32_t askTotalQuantity)
+{
+    if (replaying) {
+        return;
+    }
+    if (batching) {
+        buffer.recordBestPrice(instrument, bidPrice, bidTotalQuantity,
+                               askPrice, askTotalQuantity);
+    }
+    else if (exchange->BestPriceChanged) {
+        exchange->BestPriceChanged(
+            exchange->m_engine.instrumentName(instrument), bidPrice,
+            bidTotalQuantity, askPrice, askTotalQuantity);
+    }
+}
 
-    void printInstrumentBooks(const std::string &instrument);
+void Exchange::CallbackListener::OnCommandComplete()
+{
+    if (marketData != nullptr && !replaying) {
+        marketData->flush();
+    }
+    if (buffer.empty()) {
+        return;
+    }
+    // Callbacks may re-enter the exchange and record new events, so deliver
+    // from a detached buffer
+    EventBuffer pending = std::exchange(buffer, EventBuffer{0});
+    for (const ExchangeEvent &event : pending.events()) {
+        deliver(event);
+    }
+    pending.clear();
+    buffer = std::move(pending);
+}
 
-   private:
-    struct Order {
-        std::uint64_t orderId;
-        std::uint32_t quantity;
-    };
+void Exchange::CallbackListener::OnLevelChanged(InstrumentId instrument,
+                                                Side side, LevelAction action,
+                                                std::int64_t price,
+                                                std::uint32_t quantity)
+{
+    if (marketData != nullptr && !replaying) {
+        marketData->publishLevel(instrument, side, action, price, quantity);
+    }
+}
 
-    using PriceT = uint64_t;
+void Exchange::CallbackListener::OnInstrumentRegistered(
+    InstrumentId instrument, const std::string &name, const PriceBand *band)
+{
+    if (journal != nullptr && !replaying) {
+        journal->recordRegister(instrument, name, band);
+    }
+}
 
-    template <typename Func>
-    using PriceLevelT = std::map<PriceT, std::deque<Order>, Func>;
+void Exchange::CallbackListener::OnOrderAccepted(InstrumentId instrument,
+                                                 Side side,
+                                                 std::uint64_t orderId,
+                                                 std::int64_t price,
+                                                 std::uint32_t quantity,
+                                                 TimeInForce timeInForce,
+                                                 OrderType type,
+                                                 AccountId account)
+{
+    if (journal != nullptr && !replaying) {
+        journal->recordAdd(instrument, side, orderId, price, quantity,
+                           timeInForce, type, account);
+    }
+}
 
-    template <typename Func>
-    using OrderMapT =
-        std::unordered_map<std::string /* instrument */, PriceLevelT<Func>>;
+void Exchange::CallbackListener::OnOrderCancelled(InstrumentId instrument,
+                                                  Side side,
+                                                  std::uint64_t orderId)
+{
+    if (journal != nullptr && !replaying) {
+        journal->recordCancel(instrument, side, orderId);
+    }
+}
 
-    OrderMapT<std::less<PriceT>> m_askMap;
-    OrderMapT<std::greater<PriceT>> m_bidMap;
+void Exchange::CallbackListener::OnOrderModified(InstrumentId instrument,
+                                                 Side side,
+                                                 std::uint64_t orderId,
+                                                 std::int64_t price,
+                                                 std::uint32_t quantity)
+{
+    if (journal != nullptr && !replaying) {
+        journal->recordModify(instrument, side, orderId, price, quantity);
+    }
+}
 
-    // TODO: Make these per instrument (nested map)
-    std::unordered_map<uint64_t /* orderId */, PriceT> m_bidPriceMap;
-    std::unordered_map<uint64_t /* orderId */, PriceT> m_askPriceMap;
+void Exchange::CallbackListener::deliver(const ExchangeEvent &event)
+{
+    const std::string &name =
+        exchange->m_engine.instrumentName(event.instrument);
+    if (event.type == ExchangeEvent::Type::ORDER_TRADED) {
+        if (exchange->OrderTraded) {
+            exchange->OrderTraded(name, event.orderId, event.price,
+                                  event.quantity);
+        }
+    }
+    else if (exchange->BestPriceChanged) {
+        exchange->BestPriceChanged(name, event.price, event.quantity,
+                                   event.askPrice, event.askQuantity);
+    }
+}
 
-    std::unordered_map<PriceT, uint32_t> m_bidQuantityMap;
-    std::unordered_map<PriceT, uint32_t> m_askQuantityMap;
+InstrumentId Exchange::GetInstrumentId(const std::string &instrument)
+{
+    return m_engine.GetInstrumentId(instrument);
+}
 
-    // For generating unique order IDs
-    uint64_t m_bidOrderCount = 0;
-    uint64_t m_askOrderCount = 0;
-};
+std::expected<InstrumentId, std::string> Exchange::RegisterInstrument(
+    const std::string &instrument, const PriceBand &band)
+{
+    return m_engine.RegisterInstrument(instrument, band);
+}
 
 std::expected<std::uint64_t, std::string> Exchange::AddOrder(
     const std::string &instrument, Side side, std::int64_t price,
     std::uint32_t quantity)
 {
-    bool best_price_changed = false;
-    auto process_orders = [&](auto &targetMap, auto &oppositeMap,
-                              auto &targetQuantityMap,
-                              auto &oppositeQuantityMap, auto &&priceMatch) {
-        auto price_iter = oppositeMap[instrument].begin();
-        while (price_iter != oppositeMap[instrument].end() &&
-               priceMatch(price_iter->first, price)) {
-            auto &orders = price_iter->second;
-            auto order_iter = orders.begin();
-            while (order_iter != orders.end() && quantity > 0) {
-                // Full trade
-                if (order_iter->quantity <= quantity) {
-                    OrderTraded(instrument, order_iter->orderId,
-                                price_iter->first, order_iter->quantity);
-                    quantity -= order_iter->quantity;
-                    oppositeQuantityMap[price_iter->first] -=
-                        order_iter->quantity;
-                    order_iter = orders.erase(order_iter);
-                }
-                // Partial trade
-                else {
-                    OrderTraded(instrument, order_iter->orderId,
-                                price_iter->first, quantity);
-                    order_iter->quantity -= quantity;
-                    oppositeQuantityMap[price_iter->first] -= quantity;
-                    quantity = 0;
-                }
-            }
-            if (orders.empty()) {
-                // Remove price level if all orders are processed
-                best_price_changed = true;
-                oppositeQuantityMap.erase(price_iter->first);
-                price_iter = oppositeMap[instrument].erase(price_iter);
-            }
-            else {
-                ++price_iter;
-            }
-        }
-        if (quantity > 0) {
-            if (side == Side::BUY) {
-                m_bidPriceMap[m_bidOrderCount] = price;
-            }
-            else {
-                m_askPriceMap[m_askOrderCount] = price;
-            }
-            targetMap[instrument][price].push_back(
-                Order{side == Side::BUY ? m_bidOrderCount++ : m_askOrderCount++,
-                      quantity});
-            targetQuantityMap[price] += quantity;
-        }
-    };
+    return m_engine.AddOrder(m_engine.GetInstrumentId(instrument), side, price,
+                             quantity);
+}
 
-    if (side == Side::BUY) {
-        process_orders(m_bidMap, m_askMap, m_bidQuantityMap, m_askQuantityMap,
-                       std::less_equal<PriceT>{});
-    }
-    else {
-        process_orders(m_askMap, m_bidMap, m_askQuantityMap, m_bidQuantityMap,
-                       std::greater_equal<PriceT>{});
-    }
+std::expected<std::uint64_t, std::string> Exchange::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity)
+{
+    return m_engine.AddOrder(instrument, side, price, quantity);
+}
 
-    if (best_price_changed || !best_price_changed) {
-        PriceT best_bid_price = m_bidMap[instrument].begin()->first;
-        PriceT best_ask_price = m_askMap[instrument].begin()->first;
-        BestPriceChanged(instrument, best_bid_price,
-                         m_bidQuantityMap[best_bid_price], best_ask_price,
-                         m_askQuantityMap[best_ask_price]);
-    }
+std::expected<std::uint64_t, std::string> Exchange::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity, TimeInForce timeInForce, OrderType type)
+{
+    return m_engine.AddOrder(instrument, side, price, quantity, timeInForce,
+                             type);
+}
 
-    return 0;
+std::expected<std::uint64_t, std::string> Exchange::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity, TimeInForce timeInForce, OrderType type,
+    AccountId account)
+{
+    return m_engine.AddOrder(instrument, side, price, quantity, timeInForce,
+                             type, account);
+}
+
+std::size_t Exchange::AddOrders(
+    std::span<const BatchOrder> orders,
+    std::span<std::expected<std::uint64_t, std::string>> results)
+{
+    return m_engine.AddOrders(orders, results);
+}
+
+std::expected<std::uint64_t, std::string> Exchange::AddOrderWithId(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+    OrderType type, AccountId account)
+{
+    return m_engine.AddOrderWithId(instrument, side, orderId, price, quantity,
+                                   timeInForce, type, account);
+}
+
+std::size_t Exchange::ProcessCommands(CommandRing &ring, std::size_t maxBatch)
+{
+    return m_engine.ProcessCommands(ring, maxBatch);
 }
 
 bool Exchange::RemoveOrder(const std::string &instrument, Side side,
                            std::uint64_t orderId)
 {
-    auto remove_order = [&](auto &targetMap, auto &targetPriceMap,
-                            auto &targetQuantityMap) {
-        if (!targetMap.count(instrument) || !targetPriceMap.count(orderId)) {
-            return false;
-        }
-        PriceT price = targetPriceMap[orderId];
-        auto &price_level = targetMap[instrument][price];
-        auto order_iter = price_level.begin();
-        while (order_iter != price_level.end()) {
-            if (order_iter->orderId == orderId) {
-                targetQuantityMap[price] -= order_iter->quantity;
-                price_level.erase(order_iter);
-                return true;
-            }
-            ++order_iter;
+    auto id = m_engine.findInstrument(instrument);
+    return id && m_engine.RemoveOrder(*id, side, orderId);
+}
+
+bool Exchange::RemoveOrder(InstrumentId instrument, Side side,
+                           std::uint64_t orderId)
+{
+    return m_engine.RemoveOrder(instrument, side, orderId);
+}
+
+std::expected<std::uint64_t, std::string> Exchange::ReplayJournal(
+    const std::string &path, std::uint64_t firstRecord)
+{
+    m_engine.listener().replaying = true;
+    auto result = ::ReplayJournal(path, m_engine, firstRecord);
+    m_engine.listener().replaying = false;
+    return result;
+}
+
+std::expected<SnapshotJob, std::string> Exchange::ForkSnapshot(
+    const std::string &path)
+{
+    // The snapshot's sequence must already be in the file, or a replay
+    // from it after a crash would skip records appended later
+    Journal *journal = m_engine.listener().journal;
+    if (journal != nullptr) {
+        journal->flush();
+        if (journal->failed()) {
+            return std::unexpected("Journal failed, snapshot not taken");
         }
-        return false;
-    };
+    }
+    return ::ForkSnapshot(m_engine, path,
+                          journal != nullptr ? journal->sequence() : 0);
+}
 
-    if (side == Side::BUY) {
-        return remove_order(m_bidMap, m_bidPriceMap, m_bidQuantityMap);
+void Exchange::PublishDepthSnapshot()
+{
+    if (MarketDataPublisher *publisher = m_engine.listener().marketData) {
+        ::PublishDepthSnapshot(m_engine, *publisher);
     }
-    else {
-        return remove_order(m_askMap, m_askPriceMap, m_askQuantityMap);
+}
+
+std::expected<std::uint64_t, std::string> Exchange::LoadSnapshot(
+    const std::string &path)
+{
+    m_engine.listener().replaying = true;
+    auto result = ::LoadSnapshot(path, m_engine);
+    m_engine.listener().replaying = false;
+    return result;
+}
+
+std::expected<std::uint64_t, std::string> Exchange::ModifyOrder(
+    const std::string &instrument, Side side, std::uint64_t orderId,
+    std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    auto id = m_engine.findInstrument(instrument);
+    if (!id) {
+        return std::unexpected("Unknown instrument");
     }
+    return m_engine.ModifyOrder(*id, side, orderId, newPrice, newQuantity);
+}
+
+std::expected<std::uint64_t, std::string> Exchange::ModifyOrder(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    return m_engine.ModifyOrder(instrument, side, orderId, newPrice,
+                                newQuantity);
+}
+
+bool Exchange::RemoveOrder(std::uint64_t orderId)
+{
+    return m_engine.RemoveOrder(orderId);
+}
+
+std::size_t Exchange::MassCancel(AccountId account)
+{
+    return m_engine.MassCancel(account);
+}
+
+std::size_t Exchange::MassCancel(AccountId account, InstrumentId instrument)
+{
+    return m_engine.MassCancel(account, instrument);
+}
+
+std::size_t Exchange::MassCancel(AccountId account, InstrumentId instrument,
+                                 Side side)
+{
+    return m_engine.MassCancel(account, instrument, side);
+}
+
+std::expected<std::uint64_t, std::string> Exchange::ModifyOrder(
+    std::uint64_t orderId, std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    return m_engine.ModifyOrder(orderId, newPrice, newQuantity);
 }
 
 void Exchange::printInstrumentBooks(const std::string &instrument)
 {
-    std::cout << "Instrument=" << instrument << std::endl;
-    auto printPriceLevel = [&](auto &targetMap) {
-        if (!targetMap.count(instrument)) {
-            return;
-        }
-        const auto &price_level = targetMap[instrument];
-        for (const auto &[key, val] : price_level) {
-            std::cout << "Price=" << key << "\n";
-            for (const auto &order : val) {
-                std::cout << "{id=" << order.orderId
-                          << ", quantity=" << order.quantity << "} ";
-            }
-            std::cout << "\n";
-        }
-    };
-    std::cout << "-----------------------------\n";
-    std::cout << "Bids:\n";
-    printPriceLevel(m_bidMap);
-    std::cout << "-----------------------------\n";
-    std::cout << "Asks:\n";
-    printPriceLevel(m_askMap);
-}
-
-int main()
-{
-    Exchange ex;
-    auto orderTraded = [](const std::string &instrument, std::int64_t orderId,
-                          std::uint64_t tradedPrice,
-                          std::int64_t tradedQuantity) {
-        std::cout << "Order Traded!\nInstrument=" << instrument
-                  << ", OrderId=" << orderId << ", TradedPrice=" << tradedPrice
-                  << ", Traded Quantity=" << tradedQuantity << "\n";
-    };
-    auto bestPriceChanged =
-        [](const std::string &instrument, std::int64_t bidPrice,
-           std::uint32_t bidTotalQuantity, std::int64_t askPrice,
-           std::int32_t askTotalQuantity) {
-            std::cout << "Best Price Changed!\nInstrument=" << instrument
-                      << ", BidPrice=" << bidPrice
-                      << ", BidTotalQuantity=" << bidTotalQuantity
-                      << ", AskPrice=" << askPrice
-                      << ", AskTotalQuantity=" << askTotalQuantity << "\n";
-        };
-    ex.OrderTraded = orderTraded;
-    ex.BestPriceChanged = bestPriceChanged;
-
-    // Add some resting orders
-    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::SELL, 75, 750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::BUY, 70, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::SELL, 76, 750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::BUY, 68, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::SELL, 73, 750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Partial order executes
-    assert(ex.AddOrder("AAPL", Side::SELL, 70, 750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Level clears
-    assert(ex.AddOrder("AAPL", Side::SELL, 70, 750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Clear a level, then partially another level
-    assert(ex.AddOrder("AAPL", Side::BUY, 73, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Add on existing levels
-    assert(ex.AddOrder("AAPL", Side::BUY, 69, 500));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::BUY, 68, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Clear through two and a bit orders on level
-    assert(ex.AddOrder("AAPL", Side::SELL, 69, 1750));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Add some more resting orders
-    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Test removing one
-    assert(ex.RemoveOrder("AAPL", Side::BUY, 6));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    // Test fail removing
-    assert(!ex.RemoveOrder("AAPL", Side::BUY, 3));
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    ex.printInstrumentBooks("AAPL");
-    std::cout << "\n";
-
-    return 0;
+    m_engine.printInstrumentBooks(instrument);
 }
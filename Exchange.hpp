@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "BasicExchange.hpp"
+#include "EventBuffer.hpp"
+#include "IExchange.hpp"
+#include "Journal.hpp"
+#include "LatencyStats.hpp"
+#include "Logger.hpp"
+#include "MarketData.hpp"
+#include "OrderCommand.hpp"
+#include "PreTradeRisk.hpp"
+#include "PriceLevels.hpp"
+#include "Snapshot.hpp"
+
+// IExchange adapter over BasicExchange, delivering events through the
+// std::function callbacks
+class Exchange : public IExchange {
+   public:
+    explicit Exchange(const ExchangeConfig &config = {})
+        : m_engine(CallbackListener{this}, config)
+    {
+    }
+
+    ~Exchange() override = default;
+
+    // The engine's listener points back at this object
+    Exchange(const Exchange &) = delete;
+    Exchange &operator=(const Exchange &) = delete;
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        const std::string &instrument, Side side, std::int64_t price,
+        std::uint32_t quantity) override;
+
+    bool RemoveOrder(const std::string &instrument, Side side,
+                     std::uint64_t orderId) override;
+
+    InstrumentId GetInstrumentId(const std::string &instrument) override;
+
+    // Look up an instrument without registering it
+    std::optional<InstrumentId> findInstrument(
+        const std::string &instrument) const
+    {
+        return m_engine.findInstrument(instrument);
+    }
+
+    // Quantity resting ahead of an order at its price, in O(orders ahead)
+    // @return std::nullopt if orderId is not resting
+    std::optional<std::uint64_t> queuePosition(std::uint64_t orderId) const
+    {
+        return m_engine.queuePosition(orderId);
+    }
+
+    // Account a resting order was entered under
+    // @return std::nullopt if orderId is not resting
+    std::optional<AccountId> orderAccount(std::uint64_t orderId) const
+    {
+        return m_engine.orderAccount(orderId);
+    }
+
+    // Total quantity resting on one side of a book at price or better
+    std::uint64_t depthToPrice(InstrumentId instrument, Side side,
+                               std::int64_t price) const
+    {
+        return m_engine.depthToPrice(instrument, side, price);
+    }
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity) override;
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity, TimeInForce timeInForce,
+        OrderType type) override;
+
+    // Add an order entered under account, which the attached PreTradeRisk
+    // checks it against. The other overloads use account 0.
+    // @return unique identifier for the order or descriptive error on failure
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity, TimeInForce timeInForce, OrderType type,
+        AccountId account);
+
+    // See BasicExchange::AddOrders
+    // @return number of orders accepted
+    std::size_t AddOrders(
+        std::span<const BatchOrder> orders,
+        std::span<std::expected<std::uint64_t, std::string>> results);
+
+    bool RemoveOrder(InstrumentId instrument, Side side,
+                     std::uint64_t orderId) override;
+
+    bool RemoveOrder(std::uint64_t orderId) override;
+
+    // See BasicExchange::MassCancel
+    // @return number of orders cancelled
+    std::size_t MassCancel(AccountId account);
+    std::size_t MassCancel(AccountId account, InstrumentId instrument);
+    std::size_t MassCancel(AccountId account, InstrumentId instrument,
+                           Side side);
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        const std::string &instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) override;
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) override;
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        std::uint64_t orderId, std::int64_t newPrice,
+        std::uint32_t newQuantity) override;
+
+    // See BasicExchange::AddOrderWithId
+    std::expected<std::uint64_t, std::string> AddOrderWithId(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t price, std::uint32_t quantity,
+        TimeInForce timeInForce = TimeInForce::GTC,
+        OrderType type = OrderType::LIMIT, AccountId account = 0);
+
+    // See BasicExchange::ProcessCommands
+    std::size_t ProcessCommands(
+        CommandRing &ring,
+        std::size_t maxBatch =
+            BasicExchange<CallbackListener>::kDefaultCommandBatch);
+
+    // See BasicExchange::RegisterInstrument
+    std::expected<InstrumentId, std::string> RegisterInstrument(
+        const std::string &instrument, const PriceBand &band);
+
+    // See BasicExchange::Prewarm
+    void Prewarm() { m_engine.Prewarm(); }
+
+    void printInstrumentBooks(const std::string &instrument);
+
+    // See DumpBook
+    bool DumpBook(InstrumentId instrument, LogChannel &channel) const
+    {
+        return ::DumpBook(channel, m_engine, instrument);
+    }
+
+    // Buffer the fills and BBO changes of each add or cancel and invoke the
+    // callbacks once it has been applied, rather than from inside the match
+    // loop. Delivery order is unchanged, and callbacks may then safely call
+    // back into the exchange.
+    void SetEventBatching(bool enabled)
+    {
+        m_engine.listener().batching = enabled;
+    }
+
+    // Record every accepted command to journal from now on, or stop
+    // recording when null. The journal must outlive the attachment; an
+    // empty one first gets the instruments registered so far (see
+    // RecordInstruments).
+    void AttachJournal(Journal *journal)
+    {
+        if (journal != nullptr) {
+            RecordInstruments(*journal, m_engine);
+        }
+        m_engine.listener().journal = journal;
+    }
+
+    // Publish the level updates of every command to publisher from now on,
+    // or stop when null. The publisher must outlive the attachment.
+    void AttachMarketData(MarketDataPublisher *publisher)
+    {
+        m_engine.listener().marketData = publisher;
+    }
+
+    // Check every order against risk's limits from now on, or stop checking
+    // when null. Its counters only follow the orders that rest while it is
+    // attached, so attach it before any order rests or before ReplayJournal
+    // and LoadSnapshot; replayed orders are counted but not checked. The
+    // risk checks must outlive the attachment.
+    void AttachRisk(PreTradeRisk *risk) { m_engine.listener().risk = risk; }
+
+    // Publish a full-depth snapshot of every book to the attached publisher,
+    // e.g. periodically for late joiners or after ReplayJournal, whose
+    // commands are not published
+    void PublishDepthSnapshot();
+
+#ifdef EXCHANGE_LATENCY_STATS
+    // Time the stages of every command into stats from now on, or stop when
+    // null. The stats must outlive the attachment. Only built with
+    // EXCHANGE_LATENCY_STATS, otherwise the engine takes no timestamps.
+    void AttachLatencyStats(LatencyStats *stats)
+    {
+        m_engine.listener().latency = stats;
+    }
+#endif
+
+    // Rebuild the books from a journal before any instrument is used, or
+    // from firstRecord on after LoadSnapshot. The replayed commands are
+    // neither journaled again nor reported through the callbacks.
+    // @return number of orders replayed or descriptive error
+    std::expected<std::uint64_t, std::string> ReplayJournal(
+        const std::string &path, std::uint64_t firstRecord = 0);
+
+    // Write every book to path from a forked child, tagged with the attached
+    // journal's sequence once everything before it is written out. Fails
+    // if the journal has failed. Matching continues while the child writes.
+    // @return handle to wait on or descriptive error
+    std::expected<SnapshotJob, std::string> ForkSnapshot(
+        const std::string &path);
+
+    // Restore the books from a snapshot before any instrument is used,
+    // without journaling or reporting them
+    // @return journal record to continue ReplayJournal from or descriptive
+    // error
+    std::expected<std::uint64_t, std::string> LoadSnapshot(
+        const std::string &path);
+
+   private:
+    struct CallbackListener {
+        Exchange *exchange;
+        Journal *journal = nullptr;
+        MarketDataPublisher *marketData = nullptr;
+        PreTradeRisk *risk = nullptr;
+        bool replaying = false;
+        bool batching = false;
+        EventBuffer buffer{EventBuffer::kDefaultCapacity};
+
+        void OnOrderTraded(InstrumentId instrument, std::uint64_t orderId,
+                           std::int64_t tradedPrice,
+                           std::uint32_t tradedQuantity);
+
+        void OnBestPriceChanged(InstrumentId instrument, std::int64_t bidPrice,
+                                std::uint32_t bidTotalQuantity,
+                                std::int64_t askPrice,
+                                std::uint32_t askTotalQuantity);
+
+        void OnCommandComplete();
+
+        void OnInstrumentRegistered(InstrumentId instrument,
+                                    const std::string &name,
+                                    const PriceBand *band);
+
+        void OnOrderAccepted(InstrumentId instrument, Side side,
+                             std::uint64_t orderId, std::int64_t price,
+                             std::uint32_t quantity, TimeInForce timeInForce,
+                             OrderType type, AccountId account);
+
+        void OnOrderCancelled(InstrumentId instrument, Side side,
+                              std::uint64_t orderId);
+
+        void OnOrderModified(InstrumentId instrument, Side side,
+                             std::uint64_t orderId, std::int64_t price,
+                             std::uint32_t quantity);
+
+        void OnLevelChanged(InstrumentId instrument, Side side,
+                            LevelAction action, std::int64_t price,
+                            std::uint32_t quantity);
+
+        std::expected<void, std::string> CheckOrder(
+            const OrderRequest &request) const
+        {
+            if (risk == nullptr || replaying) {
+                return {};
+            }
+            return risk->check(request);
+        }
+
+        void OnOrderOpened(AccountId account, std::int64_t price,
+                           std::uint32_t quantity)
+        {
+            if (risk != nullptr) {
+                risk->orderOpened(account, price, quantity);
+            }
+        }
+
+        void OnOrderReduced(AccountId account, std::int64_t price,
+                            std::uint32_t quantity, bool closed)
+        {
+            if (risk != nullptr) {
+                risk->orderReduced(account, price, quantity, closed);
+            }
+        }
+
+#ifdef EXCHANGE_LATENCY_STATS
+        LatencyStats *latency = nullptr;
+
+        void OnStageLatency(InstrumentId instrument, LatencyStage stage,
+                            std::uint64_t elapsed)
+        {
+            if (latency != nullptr && !replaying) {
+                latency->record(instrument, stage, elapsed);
+            }
+        }
+#endif
+
+        void deliver(const ExchangeEvent &event);
+    };
+
+    BasicExchange<CallbackListener> m_engine;
+};
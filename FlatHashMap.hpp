@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "HugePages.hpp"
+
+// Open-addressing hash map from an unsigned integer key, for the order id
+// index. Entries live inline in one slot array, so inserts only allocate when
+// the table grows and a lookup touches a control byte group and one slot.
+//
+// Slots are probed linearly from the key's home slot. Each slot has a control
+// byte holding either kEmpty or 7 bits of the key's hash, and lookups compare
+// a whole group of control bytes at once (SSE2 where available). Erase shifts
+// the following run of entries back instead of leaving tombstones, so probe
+// lengths do not degrade under the add / cancel churn of a book.
+//
+// Inserting may move every entry and erasing may move others: both invalidate
+// iterators and references.
+template <std::unsigned_integral Key, std::default_initializable Value>
+class FlatHashMap {
+   public:
+    struct value_type {
+        Key first;
+        Value second;
+    };
+
+    using iterator = value_type *;
+    using const_iterator = const value_type *;
+
+    // Sized to hold capacity entries without growing
+    explicit FlatHashMap(std::size_t capacity = 0)
+    {
+        rehash(slotsFor(capacity));
+    }
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    iterator end() { return nullptr; }
+    const_iterator end() const { return nullptr; }
+
+    iterator find(Key key)
+    {
+        Probe probe = locate(key);
+        return probe.found ? &m_slots[probe.index] : end();
+    }
+
+    const_iterator find(Key key) const
+    {
+        Probe probe = locate(key);
+        return probe.found ? &m_slots[probe.index] : end();
+    }
+
+    bool contains(Key key) const { return locate(key).found; }
+
+    // Value is only constructed from args if key is not present
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key key, Args &&...args)
+    {
+        Probe probe = locate(key);
+        if (probe.found) {
+            return {&m_slots[probe.index], false};
+        }
+        if (m_size + 1 > m_maxSize) {
+            rehash(m_slots.size() * 2);
+            probe.index = emptySlot(hash(key));
+        }
+        value_type &slot = m_slots[probe.index];
+        slot.first = key;
+        slot.second = Value(std::forward<Args>(args)...);
+        setControl(probe.index, tag(hash(key)));
+        ++m_size;
+        return {&slot, true};
+    }
+
+    // @return number of entries erased
+    std::size_t erase(Key key)
+    {
+        Probe probe = locate(key);
+        if (!probe.found) {
+            return 0;
+        }
+        eraseSlot(probe.index);
+        return 1;
+    }
+
+    void erase(iterator iter)
+    {
+        eraseSlot(static_cast<std::size_t>(iter - m_slots.data()));
+    }
+
+    void reserve(std::size_t count)
+    {
+        std::size_t slots = slotsFor(count);
+        if (slots > m_slots.size()) {
+            rehash(slots);
+        }
+    }
+
+    // Move the table to storage first touched by the calling thread, which
+    // places it on that thread's NUMA node. With hugePages the slots ask for
+    // huge pages before they are touched.
+    void prewarm(bool hugePages)
+    {
+        std::vector<value_type> slots;
+        slots.reserve(m_slots.size());
+        if (hugePages) {
+            adviseHugePages(slots.data(), m_slots.size() * sizeof(value_type));
+        }
+        slots.assign(m_slots.begin(), m_slots.end());
+        m_slots.swap(slots);
+        m_control = std::vector<std::int8_t>(m_control);
+    }
+
+    void clear()
+    {
+        std::fill(m_control.begin(), m_control.end(), kEmpty);
+        m_size = 0;
+    }
+
+   private:
+    static constexpr std::size_t kGroupWidth = 16;
+    static constexpr std::int8_t kEmpty = -128;
+    // Fibonacci hashing, the golden ratio spreads sequential ids over the
+    // whole table
+    static constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15;
+    static constexpr int kTagBits = 7;
+
+    // Control bytes of kGroupWidth consecutive slots
+    class Group {
+       public:
+        explicit Group(const std::int8_t *control)
+#if defined(__SSE2__)
+            : m_control(_mm_loadu_si128(
+                  reinterpret_cast<const __m128i *>(control)))
+#else
+            : m_control(control)
+#endif
+        {
+        }
+
+        // Bit i set if slot i holds tag
+        std::uint32_t match(std::int8_t tag) const
+        {
+#if defined(__SSE2__)
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(
+                _mm_cmpeq_epi8(m_control, _mm_set1_epi8(tag))));
+#else
+            std::uint32_t bits = 0;
+            for (std::size_t i = 0; i < kGroupWidth; ++i) {
+                bits |= std::uint32_t{m_control[i] == tag} << i;
+            }
+            return bits;
+#endif
+        }
+
+        // Bit i set if slot i is empty
+        std::uint32_t matchEmpty() const
+        {
+#if defined(__SSE2__)
+            // kEmpty is the only control byte with its sign bit set
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(m_control));
+#else
+            return match(kEmpty);
+#endif
+        }
+
+       private:
+#if defined(__SSE2__)
+        __m128i m_control;
+#else
+        const std::int8_t *m_control;
+#endif
+    };
+
+    struct Probe {
+        // Slot holding the key if found, else the empty slot it would go in
+        std::size_t index;
+        bool found;
+    };
+
+    std::vector<value_type> m_slots;
+    // One byte per slot followed by a copy of the first kGroupWidth bytes,
+    // so that a group starting near the end can be loaded in one go
+    std::vector<std::int8_t> m_control;
+    std::size_t m_mask = 0;
+    int m_shift = 0;
+    std::size_t m_size = 0;
+    std::size_t m_maxSize = 0;
+
+    // Power of two with count at most 7/8 full
+    static std::size_t slotsFor(std::size_t count)
+    {
+        return std::bit_ceil(std::max(kGroupWidth, count + count / 7 + 1));
+    }
+
+    std::uint64_t hash(Key key) const
+    {
+        return static_cast<std::uint64_t>(key) * kMultiplier;
+    }
+
+    std::size_t home(std::uint64_t hash) const { return hash >> m_shift; }
+
+    // Hash bits just below those that pick the home slot
+    std::int8_t tag(std::uint64_t hash) const
+    {
+        return static_cast<std::int8_t>((hash >> (m_shift - kTagBits)) &
+                                        ((1 << kTagBits) - 1));
+    }
+
+    Probe locate(Key key) const
+    {
+        std::uint64_t keyHash = hash(key);
+        std::int8_t keyTag = tag(keyHash);
+        std::size_t position = home(keyHash);
+        while (true) {
+            Group group(&m_control[position]);
+            for (std::uint32_t bits = group.match(keyTag); bits != 0;
+                 bits &= bits - 1) {
+                std::size_t index =
+                    (position + std::countr_zero(bits)) & m_mask;
+                if (m_slots[index].first == key) {
+                    return {index, true};
+                }
+            }
+            // Entries never sit past the first empty slot of their run
+            if (std::uint32_t empty = group.matchEmpty(); empty != 0) {
+                return {(position + std::countr_zero(empty)) & m_mask, false};
+            }
+            position = (position + kGroupWidth) & m_mask;
+        }
+    }
+
+    std::size_t emptySlot(std::uint64_t hash) const
+    {
+        std::size_t position = home(hash);
+        while (true) {
+            if (std::uint32_t empty = Group(&m_control[position]).matchEmpty();
+                empty != 0) {
+                return (position + std::countr_zero(empty)) & m_mask;
+            }
+            position = (position + kGroupWidth) & m_mask;
+        }
+    }
+
+    void setControl(std::size_t index, std::int8_t value)
+    {
+        m_control[index] = value;
+        if (index < kGroupWidth) {
+            m_control[m_slots.size() + index] = value;
+        }
+    }
+
+    // Backward-shift deletion: pull each later entry of the run into the
+    // hole if that keeps it at or after its home slot
+    void eraseSlot(std::size_t hole)
+    {
+        for (std::size_t next = (hole + 1) & m_mask; m_control[next] != kEmpty;
+             next = (next + 1) & m_mask) {
+            std::size_t nextHome = home(hash(m_slots[next].first));
+            if (((next - nextHome) & m_mask) >= ((next - hole) & m_mask)) {
+                m_slots[hole] = std::move(m_slots[next]);
+                setControl(hole, m_control[next]);
+                hole = next;
+            }
+        }
+        setControl(hole, kEmpty);
+        --m_size;
+    }
+
+    void rehash(std::size_t slots)
+    {
+        std::vector<value_type> oldSlots(slots);
+        std::vector<std::int8_t> oldControl(slots + kGroupWidth, kEmpty);
+        oldSlots.swap(m_slots);
+        oldControl.swap(m_control);
+        m_mask = slots - 1;
+        m_shift = 64 - std::countr_zero(slots);
+        m_maxSize = slots - slots / 8;
+        for (std::size_t i = 0; i < oldSlots.size(); ++i) {
+            if (oldControl[i] == kEmpty) {
+                continue;
+            }
+            std::uint64_t keyHash = hash(oldSlots[i].first);
+            std::size_t index = emptySlot(keyHash);
+            m_slots[index] = std::move(oldSlots[i]);
+            setControl(index, tag(keyHash));
+        }
+    }
+};
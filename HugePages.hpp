@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+inline constexpr std::size_t kHugePageSize = std::size_t{2} << 20;
+
+// Ask the kernel to back the whole huge pages within [data, data + bytes)
+// with transparent huge pages, so that the pages faulted in there afterwards
+// cost one TLB entry per 2 MiB. Best effort: a no-op off Linux, for buffers
+// smaller than a huge page, or when transparent huge pages are disabled.
+inline void adviseHugePages(const void *data, std::size_t bytes)
+{
+#ifdef __linux__
+    auto address = reinterpret_cast<std::uintptr_t>(data);
+    std::uintptr_t begin = (address + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    std::uintptr_t end = (address + bytes) & ~(kHugePageSize - 1);
+    if (begin < end) {
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_HUGEPAGE);
+    }
+#else
+    (void)data;
+    (void)bytes;
+#endif
+}
+
+// Fault in the storage items reserved beyond its size, leaving its contents
+// unchanged. With hugePages it asks for huge pages first.
+template <typename T>
+void prefaultReserved(std::vector<T> &items, bool hugePages)
+{
+    if (hugePages) {
+        adviseHugePages(items.data(), items.capacity() * sizeof(T));
+    }
+    std::size_t size = items.size();
+    items.resize(items.capacity());
+    items.resize(size);
+}
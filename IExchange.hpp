@@ -5,7 +5,25 @@
 #include <functional>
 #include <string>
 
-enum class Side { BUY, SELL };
+enum class Side : std::uint8_t { BUY, SELL };
+
+// What happens to the part of an order that does not trade on arrival
+enum class TimeInForce : std::uint8_t {
+    GTC,  // rest on the book until cancelled
+    IOC,  // immediate or cancel: drop it
+    FOK,  // fill or kill: trade the whole order at once or none of it
+};
+
+// A market order trades at any price and is never booked, so its time in
+// force must be IOC or FOK and its price is ignored
+enum class OrderType : std::uint8_t { LIMIT, MARKET };
+
+// Dense handle for a registered instrument, see IExchange::GetInstrumentId
+using InstrumentId = std::uint32_t;
+
+// Trading account an order is entered under, for per-account risk limits
+// (see PreTradeRisk). Orders entered without one belong to account 0.
+using AccountId = std::uint16_t;
 
 // Example exchange interface
 class IExchange {
@@ -23,6 +41,55 @@ class IExchange {
     virtual bool RemoveOrder(const std::string &instrument, Side side,
                              std::uint64_t orderId) = 0;
 
+    // Resolve an instrument name to its dense handle, registering the
+    // instrument on first use. Callers on the hot path should resolve once
+    // and use the InstrumentId overloads below.
+    virtual InstrumentId GetInstrumentId(const std::string &instrument) = 0;
+
+    // Add an order to the exchange for a previously resolved instrument
+    // @return unique identifier for the order or descriptive error on failure
+    virtual std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity) = 0;
+
+    // Add an order with an explicit time in force and type. An IOC or market
+    // order whose remainder is dropped still gets an id, a fill-or-kill order
+    // that cannot fill completely is rejected without trading.
+    // @return unique identifier for the order or descriptive error on failure
+    virtual std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity, TimeInForce timeInForce, OrderType type) = 0;
+
+    // Remove an order from the exchange for a previously resolved instrument
+    // @return success or failure
+    virtual bool RemoveOrder(InstrumentId instrument, Side side,
+                             std::uint64_t orderId) = 0;
+
+    // Remove an order by id alone, order ids are unique across instruments
+    // and sides
+    // @return success or failure
+    virtual bool RemoveOrder(std::uint64_t orderId) = 0;
+
+    // Amend a resting order's price and quantity in one step, keeping its id.
+    // A smaller quantity at the same price keeps the order's time priority,
+    // any other change moves it to the back of its new price level.
+    // @return the order's identifier or descriptive error on failure
+    virtual std::expected<std::uint64_t, std::string> ModifyOrder(
+        const std::string &instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) = 0;
+
+    // Amend an order for a previously resolved instrument, see above
+    // @return the order's identifier or descriptive error on failure
+    virtual std::expected<std::uint64_t, std::string> ModifyOrder(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) = 0;
+
+    // Amend an order by id alone, see above
+    // @return the order's identifier or descriptive error on failure
+    virtual std::expected<std::uint64_t, std::string> ModifyOrder(
+        std::uint64_t orderId, std::int64_t newPrice,
+        std::uint32_t newQuantity) = 0;
+
     // callback to indicate an order has been matched
     std::function<void(const std::string &instrument, std::uint64_t orderId,
                        std::int64_t tradedPrice, std::uint32_t tradedQuantity)>
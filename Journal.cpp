@@ -0,0 +1,257 @@
+#include "Journal.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// How long the writer sleeps when it finds nothing to write
+constexpr auto kIdleSleep = std::chrono::microseconds(50);
+
+std::string systemError(const std::string &what, const std::string &path)
+{
+    return what + " " + path + ": " + std::strerror(errno);
+}
+
+}  // namespace
+
+std::expected<std::unique_ptr<Journal>, std::string> Journal::Open(
+    const std::string &path, bool sync, std::size_t queueCapacity)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        return std::unexpected(systemError("Cannot open journal", path));
+    }
+    // A torn record at the end of a crashed journal would misalign every
+    // record appended after it
+    off_t size = ::lseek(fd, 0, SEEK_END);
+    off_t torn = size % static_cast<off_t>(sizeof(JournalRecord));
+    if (size < 0 || (torn != 0 && ::ftruncate(fd, size - torn) != 0)) {
+        std::string error = systemError("Cannot truncate journal", path);
+        ::close(fd);
+        return std::unexpected(error);
+    }
+    auto firstRecord =
+        static_cast<std::uint64_t>(size - torn) / sizeof(JournalRecord);
+    return std::unique_ptr<Journal>(
+        new Journal(fd, firstRecord, sync, queueCapacity));
+}
+
+Journal::Journal(int fd, std::uint64_t firstRecord, bool sync,
+                 std::size_t queueCapacity)
+    : m_fd(fd), m_firstRecord(firstRecord), m_sync(sync), m_queue(queueCapacity)
+{
+    m_writer = std::thread([this] { run(); });
+}
+
+Journal::~Journal()
+{
+    m_stopping.store(true, std::memory_order_release);
+    m_writer.join();
+    ::close(m_fd);
+}
+
+void Journal::recordRegister(InstrumentId instrument, const std::string &name,
+                             const PriceBand *band)
+{
+    JournalRecord record{};
+    record.type = JournalRecord::Type::REGISTER;
+    record.instrument = instrument;
+    record.band = band != nullptr ? *band : PriceBand{};
+    if (name.size() > UINT16_MAX) {
+        // Not representable, and replay could not rebuild the ids after it
+        m_failed.store(true, std::memory_order_release);
+        return;
+    }
+    record.nameLength = static_cast<std::uint16_t>(name.size());
+    append(record);
+    for (std::size_t offset = 0; offset < name.size();
+         offset += JournalRecord::kNameBytes) {
+        JournalRecord chunk{};
+        chunk.type = JournalRecord::Type::NAME;
+        chunk.instrument = instrument;
+        name.copy(chunk.name, JournalRecord::kNameBytes, offset);
+        append(chunk);
+    }
+}
+
+void Journal::recordAdd(InstrumentId instrument, Side side,
+                        std::uint64_t orderId, std::int64_t price,
+                        std::uint32_t quantity, TimeInForce timeInForce,
+                        OrderType type, AccountId account)
+{
+    JournalRecord record{};
+    record.type = JournalRecord::Type::ADD;
+    record.side = side;
+    record.instrument = instrument;
+    record.order = {orderId, price, quantity, timeInForce, type, account};
+    append(record);
+}
+
+void Journal::recordCancel(InstrumentId instrument, Side side,
+                           std::uint64_t orderId)
+{
+    JournalRecord record{};
+    record.type = JournalRecord::Type::CANCEL;
+    record.side = side;
+    record.instrument = instrument;
+    record.order = {orderId, 0, 0, TimeInForce::GTC, OrderType::LIMIT, 0};
+    append(record);
+}
+
+void Journal::recordModify(InstrumentId instrument, Side side,
+                           std::uint64_t orderId, std::int64_t price,
+                           std::uint32_t quantity)
+{
+    JournalRecord record{};
+    record.type = JournalRecord::Type::MODIFY;
+    record.side = side;
+    record.instrument = instrument;
+    record.order = {orderId, price, quantity, TimeInForce::GTC,
+                    OrderType::LIMIT, 0};
+    append(record);
+}
+
+void Journal::append(const JournalRecord &record)
+{
+    // Back-pressure: wait for the writer rather than lose a record
+    while (!m_queue.tryPush(record)) {
+        if (failed()) {
+            return;
+        }
+        cpuRelax();
+    }
+    ++m_appended;
+}
+
+void Journal::flush()
+{
+    while (m_written.load(std::memory_order_acquire) < m_appended &&
+           !failed()) {
+        std::this_thread::yield();
+    }
+}
+
+void Journal::run()
+{
+    std::vector<JournalRecord> batch;
+    batch.reserve(kWriteBatch);
+    auto collect = [&batch](const JournalRecord &record) {
+        batch.push_back(record);
+    };
+    while (true) {
+        // Whatever queued up during the last write and sync forms the next
+        // group
+        m_queue.popBatch(collect, kWriteBatch);
+        if (batch.empty()) {
+            if (m_stopping.load(std::memory_order_acquire) &&
+                m_queue.empty()) {
+                return;
+            }
+            std::this_thread::sleep_for(kIdleSleep);
+            continue;
+        }
+        if (!failed()) {
+            const char *data = reinterpret_cast<const char *>(batch.data());
+            std::size_t remaining = batch.size() * sizeof(JournalRecord);
+            while (remaining > 0) {
+                ssize_t written = ::write(m_fd, data, remaining);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    m_failed.store(true, std::memory_order_release);
+                    break;
+                }
+                data += written;
+                remaining -= static_cast<std::size_t>(written);
+            }
+            if (m_sync && !failed() && ::fdatasync(m_fd) != 0) {
+                m_failed.store(true, std::memory_order_release);
+            }
+        }
+        m_written.fetch_add(batch.size(), std::memory_order_release);
+        batch.clear();
+    }
+}
+
+std::expected<JournalReader, std::string> JournalReader::Open(
+    const std::string &path, std::size_t chunkRecords)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::unexpected(systemError("Cannot open journal", path));
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return JournalReader(fd, chunkRecords);
+}
+
+JournalReader::JournalReader(int fd, std::size_t chunkRecords)
+    : m_fd(fd), m_chunk(chunkRecords != 0 ? chunkRecords : 1)
+{
+}
+
+JournalReader::JournalReader(JournalReader &&other) noexcept
+    : m_fd(std::exchange(other.m_fd, -1)), m_chunk(std::move(other.m_chunk))
+{
+}
+
+JournalReader::~JournalReader()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+std::expected<std::span<const JournalRecord>, std::string>
+JournalReader::next()
+{
+    char *data = reinterpret_cast<char *>(m_chunk.data());
+    std::size_t capacity = m_chunk.size() * sizeof(JournalRecord);
+    std::size_t filled = 0;
+    while (filled < capacity) {
+        ssize_t count = ::read(m_fd, data + filled, capacity - filled);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return std::unexpected(
+                std::string("Cannot read journal: ") + std::strerror(errno));
+        }
+        if (count == 0) {
+            break;
+        }
+        filled += static_cast<std::size_t>(count);
+    }
+    return std::span<const JournalRecord>(m_chunk.data(),
+                                          filled / sizeof(JournalRecord));
+}
+
+std::expected<void, std::string> JournalReader::seek(std::uint64_t record)
+{
+    struct stat status {};
+    if (::fstat(m_fd, &status) != 0) {
+        return std::unexpected(std::string("Cannot stat journal: ") +
+                               std::strerror(errno));
+    }
+    if (record > static_cast<std::uint64_t>(status.st_size) /
+                     sizeof(JournalRecord)) {
+        return std::unexpected("Journal ends before record " +
+                               std::to_string(record));
+    }
+    auto offset = static_cast<off_t>(record * sizeof(JournalRecord));
+    if (::lseek(m_fd, offset, SEEK_SET) < 0) {
+        return std::unexpected(std::string("Cannot seek journal: ") +
+                               std::strerror(errno));
+    }
+    return {};
+}
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+#include "PriceLevels.hpp"
+#include "SpscRing.hpp"
+
+// One fixed-size entry of the binary journal. Records are written in the
+// order the exchange applied them, so replaying them into an empty exchange
+// rebuilds the same books and ids.
+struct JournalRecord {
+    enum class Type : std::uint8_t { REGISTER, ADD, CANCEL, NAME, MODIFY };
+
+    struct OrderFields {
+        std::uint64_t orderId;
+        std::int64_t price;       // ADD and MODIFY only
+        std::uint32_t quantity;   // ADD and MODIFY only
+        TimeInForce timeInForce;  // ADD only
+        OrderType orderType;      // ADD only
+        AccountId account;        // ADD only
+    };
+
+    static constexpr std::size_t kNameBytes = 24;
+
+    Type type;
+    Side side;
+    // REGISTER only, the name follows in that many bytes of NAME records
+    std::uint16_t nameLength;
+    InstrumentId instrument;
+    union {
+        OrderFields order;  // ADD, CANCEL, MODIFY
+        PriceBand band;     // REGISTER, a tick size of 0 for a tree of levels
+        char name[kNameBytes];  // NAME
+    };
+};
+
+static_assert(sizeof(JournalRecord) == 32 &&
+                  std::is_trivially_copyable_v<JournalRecord>,
+              "journal records are written and read as raw bytes");
+
+// Append-only writer of a journal file. The matching thread only copies
+// records into a ring; a background thread writes them out in groups, each
+// followed by one fdatasync when sync is set.
+class Journal {
+   public:
+    static constexpr std::size_t kDefaultQueueCapacity = 1 << 16;
+
+    // Open path for appending, creating it if needed
+    static std::expected<std::unique_ptr<Journal>, std::string> Open(
+        const std::string &path, bool sync = true,
+        std::size_t queueCapacity = kDefaultQueueCapacity);
+
+    // Writes out everything appended before returning
+    ~Journal();
+
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    // Called from the matching thread only
+    void recordRegister(InstrumentId instrument, const std::string &name,
+                        const PriceBand *band);
+    void recordAdd(InstrumentId instrument, Side side, std::uint64_t orderId,
+                   std::int64_t price, std::uint32_t quantity,
+                   TimeInForce timeInForce, OrderType type,
+                   AccountId account);
+    void recordCancel(InstrumentId instrument, Side side,
+                      std::uint64_t orderId);
+    void recordModify(InstrumentId instrument, Side side,
+                      std::uint64_t orderId, std::int64_t price,
+                      std::uint32_t quantity);
+
+    // Block until every record appended so far is written (and synced)
+    void flush();
+
+    // Position in the file after the last record appended, counted in
+    // records. A snapshot taken now covers every record before it, but the
+    // records may not be written yet: flush, and check failed, before
+    // tagging a snapshot with it.
+    std::uint64_t sequence() const { return m_firstRecord + m_appended; }
+
+    // True if that many more records can be appended without waiting for
+    // the writer. Conservative, the writer may already have taken more.
+    bool canAppend(std::size_t records) const
+    {
+        return m_appended - m_written.load(std::memory_order_acquire) +
+                   records <=
+               m_queue.capacity();
+    }
+
+    // True once a write failed, later records are dropped
+    bool failed() const { return m_failed.load(std::memory_order_acquire); }
+
+   private:
+    // Records written per write() call at most
+    static constexpr std::size_t kWriteBatch = 4096;
+
+    Journal(int fd, std::uint64_t firstRecord, bool sync,
+            std::size_t queueCapacity);
+
+    void append(const JournalRecord &record);
+    void run();
+
+    int m_fd;
+    // Records already in the file when it was opened
+    std::uint64_t m_firstRecord;
+    bool m_sync;
+    SpscRing<JournalRecord> m_queue;
+
+    // Records appended since, only touched by the matching thread
+    std::uint64_t m_appended = 0;
+    // Records written out by the background thread
+    std::atomic<std::uint64_t> m_written{0};
+    std::atomic<bool> m_failed{false};
+    std::atomic<bool> m_stopping{false};
+    std::thread m_writer;
+};
+
+// Sequential chunked reader of a journal file
+class JournalReader {
+   public:
+    static constexpr std::size_t kDefaultChunk = 64 * 1024;
+
+    static std::expected<JournalReader, std::string> Open(
+        const std::string &path, std::size_t chunkRecords = kDefaultChunk);
+
+    JournalReader(JournalReader &&other) noexcept;
+    JournalReader &operator=(JournalReader &&) = delete;
+    ~JournalReader();
+
+    // Next run of records, empty at the end of the file. A torn record left
+    // by a crash mid-write is ignored.
+    std::expected<std::span<const JournalRecord>, std::string> next();
+
+    // Continue reading at the record-th record of the file, failing if the
+    // file holds fewer records, e.g. a snapshot's sequence from a journal
+    // whose tail was lost
+    std::expected<void, std::string> seek(std::uint64_t record);
+
+   private:
+    JournalReader(int fd, std::size_t chunkRecords);
+
+    int m_fd;
+    std::vector<JournalRecord> m_chunk;
+};
+
+// Applies the records of a journal to an exchange one at a time, see
+// ReplayJournal. With partitions > 1 only the instruments whose journal id
+// is partition modulo partitions are registered and replayed, under dense
+// ids of their own, so that one journal can be split across several
+// exchanges (see ParallelReplayJournal); records of other instruments are
+// skipped.
+template <ExchangeListener Listener>
+class JournalApplier {
+   public:
+    explicit JournalApplier(BasicExchange<Listener> &exchange,
+                            std::size_t partition = 0,
+                            std::size_t partitions = 1)
+        : m_exchange(exchange),
+          m_partition(partition),
+          m_partitions(partitions != 0 ? partitions : 1)
+    {
+    }
+
+    // @return success or descriptive error
+    std::expected<void, std::string> apply(const JournalRecord &record);
+
+    // Call once the journal has ended. AddOrder then continues numbering
+    // after the replayed ids.
+    // @return number of orders added, cancelled and modified, or descriptive
+    // error
+    std::expected<std::uint64_t, std::string> finish();
+
+    // Journal id of each instrument registered so far, in order, so indexed
+    // by exchange id when the exchange started out without instruments
+    const std::vector<InstrumentId> &journalIds() const
+    {
+        return m_journalIds;
+    }
+
+   private:
+    static constexpr InstrumentId kSkipped =
+        std::numeric_limits<InstrumentId>::max();
+
+    BasicExchange<Listener> &m_exchange;
+    std::size_t m_partition;
+    std::size_t m_partitions;
+    std::uint64_t m_commands = 0;
+    std::uint64_t m_nextOrderId = 0;
+
+    // REGISTER whose name is still being read from NAME records
+    JournalRecord m_pending{};
+    std::string m_name;
+    bool m_registering = false;
+
+    // Indexed by journal id, when partitioned
+    std::vector<InstrumentId> m_exchangeIds;
+    std::vector<InstrumentId> m_journalIds;
+
+    // @return kSkipped for instruments of other partitions
+    InstrumentId exchangeId(InstrumentId journalId) const
+    {
+        if (m_partitions == 1) {
+            return journalId;
+        }
+        return journalId < m_exchangeIds.size() ? m_exchangeIds[journalId]
+                                                 : kSkipped;
+    }
+
+    std::expected<void, std::string> registerPending();
+};
+
+template <ExchangeListener Listener>
+std::expected<void, std::string> JournalApplier<Listener>::registerPending()
+{
+    m_registering = false;
+    InstrumentId journalId = m_pending.instrument;
+    // A single partition keeps the journal's ids, which a snapshot restored
+    // before the journal's tail also relies on
+    InstrumentId expected = journalId;
+    if (m_partitions != 1) {
+        if (journalId % m_partitions != m_partition) {
+            return {};
+        }
+        expected = static_cast<InstrumentId>(m_journalIds.size());
+    }
+    bool matches;
+    if (m_pending.band.tickSize == 0) {
+        matches = m_exchange.GetInstrumentId(m_name) == expected;
+    }
+    else {
+        auto id = m_exchange.RegisterInstrument(m_name, m_pending.band);
+        matches = id && *id == expected;
+    }
+    if (!matches) {
+        return std::unexpected(
+            "Journal does not match the exchange's instruments");
+    }
+    if (m_partitions != 1) {
+        if (journalId >= m_exchangeIds.size()) {
+            m_exchangeIds.resize(journalId + 1, kSkipped);
+        }
+        m_exchangeIds[journalId] = expected;
+    }
+    m_journalIds.push_back(journalId);
+    return {};
+}
+
+template <ExchangeListener Listener>
+std::expected<void, std::string> JournalApplier<Listener>::apply(
+    const JournalRecord &record)
+{
+    if (m_registering) {
+        if (record.type != JournalRecord::Type::NAME) {
+            return std::unexpected("Truncated instrument name");
+        }
+        std::size_t take = std::min(JournalRecord::kNameBytes,
+                                    m_pending.nameLength - m_name.size());
+        m_name.append(record.name, take);
+        if (m_name.size() == m_pending.nameLength) {
+            return registerPending();
+        }
+        return {};
+    }
+    if (record.type == JournalRecord::Type::REGISTER) {
+        m_pending = record;
+        m_name.clear();
+        m_registering = true;
+        if (record.nameLength == 0) {
+            return registerPending();
+        }
+        return {};
+    }
+    if (record.type == JournalRecord::Type::NAME) {
+        return std::unexpected("Unexpected instrument name");
+    }
+    // Ids are shared by every instrument, so all partitions number on after
+    // the last one in the journal
+    if (record.type == JournalRecord::Type::ADD) {
+        m_nextOrderId = std::max(m_nextOrderId, record.order.orderId + 1);
+    }
+    InstrumentId instrument = exchangeId(record.instrument);
+    if (instrument == kSkipped) {
+        return {};
+    }
+    // Only accepted commands are journaled, so one the exchange refuses
+    // means its books have diverged from the ones that were recorded
+    bool matches = true;
+    switch (record.type) {
+        case JournalRecord::Type::ADD: {
+            auto added = m_exchange.AddOrderWithId(
+                instrument, record.side, record.order.orderId,
+                record.order.price, record.order.quantity,
+                record.order.timeInForce, record.order.orderType,
+                record.order.account);
+            matches = added.has_value();
+            break;
+        }
+        case JournalRecord::Type::CANCEL:
+            matches = m_exchange.RemoveOrder(instrument, record.side,
+                                             record.order.orderId);
+            break;
+        case JournalRecord::Type::MODIFY: {
+            auto modified = m_exchange.ModifyOrder(
+                instrument, record.side, record.order.orderId,
+                record.order.price, record.order.quantity);
+            matches = modified.has_value();
+            break;
+        }
+        default:
+            break;
+    }
+    if (!matches) {
+        return std::unexpected("Journal does not match the exchange");
+    }
+    ++m_commands;
+    return {};
+}
+
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> JournalApplier<Listener>::finish()
+{
+    if (m_registering) {
+        return std::unexpected("Truncated instrument name");
+    }
+    m_exchange.ReserveOrderIds(m_nextOrderId);
+    return m_commands;
+}
+
+// Record the instruments exchange already has to a journal that is empty,
+// so that it replays on its own when attached after they were registered.
+// A journal with records is taken to continue one that has them already.
+// Orders already resting are not recorded; a snapshot taken along with the
+// journal covers them (see WriteSnapshot).
+template <ExchangeListener Listener>
+void RecordInstruments(Journal &journal,
+                       const BasicExchange<Listener> &exchange)
+{
+    if (journal.sequence() != 0) {
+        return;
+    }
+    for (std::size_t i = 0; i < exchange.instrumentCount(); ++i) {
+        auto instrument = static_cast<InstrumentId>(i);
+        journal.recordRegister(instrument, exchange.instrumentName(instrument),
+                               exchange.instrumentBand(instrument));
+    }
+}
+
+// Apply a journal to an exchange that has no instruments yet, or from
+// firstRecord on to one restored from a snapshot taken at that sequence
+// (see LoadSnapshot). The exchange's listener sees the replayed commands and
+// events like live ones, so it should neither journal them again nor publish
+// them (see Exchange::ReplayJournal). AddOrder continues numbering after the
+// replayed ids.
+// @return number of orders added, cancelled and modified, or descriptive
+// error
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> ReplayJournal(
+    const std::string &path, BasicExchange<Listener> &exchange,
+    std::uint64_t firstRecord = 0)
+{
+    auto reader = JournalReader::Open(path);
+    if (!reader) {
+        return std::unexpected(reader.error());
+    }
+    if (auto sought = reader->seek(firstRecord); !sought) {
+        return std::unexpected(sought.error());
+    }
+    JournalApplier<Listener> applier(exchange);
+    while (true) {
+        auto records = reader->next();
+        if (!records) {
+            return std::unexpected(records.error());
+        }
+        if (records->empty()) {
+            break;
+        }
+        for (const JournalRecord &record : *records) {
+            if (auto applied = applier.apply(record); !applied) {
+                return std::unexpected(std::move(applied.error()));
+            }
+        }
+    }
+    return applier.finish();
+}
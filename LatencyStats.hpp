@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "IExchange.hpp"
+
+// Stages of a command timed for a LatencyListener, each from the end of the
+// previous one:
+//   LOOKUP    resolving the book or order and validating the command
+//   MATCH     the match loop, including listener calls made from it
+//   REST      booking the remainder of an add, or amending in place
+//   CANCEL    taking an order off its book, for cancels and amends
+//   DISPATCH  the best price update and completing the command
+enum class LatencyStage : std::uint8_t {
+    LOOKUP,
+    MATCH,
+    REST,
+    CANCEL,
+    DISPATCH
+};
+inline constexpr std::size_t kLatencyStageCount = 5;
+
+// Cheap timestamp for stage boundaries: the TSC in cycles on x86, else
+// nanoseconds
+inline std::uint64_t readTimestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Counts of a LatencyHistogram at one point in time
+struct LatencySnapshot {
+    static constexpr int kSubBucketBits = 4;
+    static constexpr std::uint64_t kSubBuckets = 1 << kSubBucketBits;
+    // Values of 2^32 and above share the last bucket
+    static constexpr std::size_t kBucketCount = (32 - kSubBucketBits + 1) *
+                                                kSubBuckets;
+
+    std::array<std::uint64_t, kBucketCount> counts{};
+
+    // HDR-style log-linear buckets: exact below kSubBuckets, then
+    // kSubBuckets per power of two, within 1/16th of the value
+    static std::size_t bucketOf(std::uint64_t value)
+    {
+        if (value < kSubBuckets) {
+            return static_cast<std::size_t>(value);
+        }
+        if (value >> 32 != 0) {
+            return kBucketCount - 1;
+        }
+        int magnitude = std::bit_width(value) - 1;
+        return static_cast<std::size_t>(
+            (magnitude - kSubBucketBits + 1) * kSubBuckets +
+            ((value >> (magnitude - kSubBucketBits)) & (kSubBuckets - 1)));
+    }
+
+    // Largest value counted in bucket
+    static std::uint64_t bucketLimit(std::size_t bucket)
+    {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / kSubBuckets) - 1;
+        std::uint64_t lower = (kSubBuckets + bucket % kSubBuckets) << shift;
+        return lower + (std::uint64_t{1} << shift) - 1;
+    }
+
+    std::uint64_t count() const
+    {
+        std::uint64_t total = 0;
+        for (std::uint64_t bucketCount : counts) {
+            total += bucketCount;
+        }
+        return total;
+    }
+
+    // Upper bound of the p-th quantile, p in [0, 1], 0 when empty
+    std::uint64_t percentile(double p) const
+    {
+        std::uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(p * (total - 1));
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+            seen += counts[bucket];
+            if (seen > rank) {
+                return bucketLimit(bucket);
+            }
+        }
+        return bucketLimit(kBucketCount - 1);
+    }
+};
+
+// Histogram written by the matching thread and read by one monitoring thread
+// without locks. Recording is a relaxed load and store of one counter, as
+// only the matcher writes them; reset() only moves the reader's baseline, so
+// it never races with recording.
+class LatencyHistogram {
+   public:
+    // Matching thread only
+    void record(std::uint64_t value)
+    {
+        std::atomic<std::uint64_t> &counter =
+            m_counts[LatencySnapshot::bucketOf(value)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    }
+
+    // Monitoring thread only: counts recorded since the last reset
+    LatencySnapshot snapshot() const
+    {
+        LatencySnapshot result;
+        for (std::size_t i = 0; i < LatencySnapshot::kBucketCount; ++i) {
+            result.counts[i] = m_counts[i].load(std::memory_order_relaxed) -
+                               m_baseline[i];
+        }
+        return result;
+    }
+
+    void reset()
+    {
+        for (std::size_t i = 0; i < LatencySnapshot::kBucketCount; ++i) {
+            m_baseline[i] = m_counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+   private:
+    std::array<std::atomic<std::uint64_t>, LatencySnapshot::kBucketCount>
+        m_counts{};
+    std::array<std::uint64_t, LatencySnapshot::kBucketCount> m_baseline{};
+};
+
+// Per instrument and stage latency histograms, for a listener implementing
+// OnStageLatency (see LatencyListener). Sized up front so the monitoring
+// thread never sees the storage move; instruments past the capacity are not
+// recorded.
+class LatencyStats {
+   public:
+    static constexpr std::size_t kDefaultInstruments = 16;
+
+    explicit LatencyStats(std::size_t instruments = kDefaultInstruments)
+        : m_instruments(instruments)
+    {
+    }
+
+    LatencyStats(const LatencyStats &) = delete;
+    LatencyStats &operator=(const LatencyStats &) = delete;
+
+    // Matching thread only
+    void record(InstrumentId instrument, LatencyStage stage,
+                std::uint64_t elapsed)
+    {
+        if (instrument < m_instruments.size()) {
+            m_instruments[instrument][static_cast<std::size_t>(stage)].record(
+                elapsed);
+        }
+    }
+
+    std::size_t instrumentCapacity() const { return m_instruments.size(); }
+
+    // Monitoring thread only
+    // @pre instrument < instrumentCapacity()
+    LatencySnapshot snapshot(InstrumentId instrument, LatencyStage stage) const
+    {
+        return m_instruments[instrument][static_cast<std::size_t>(stage)]
+            .snapshot();
+    }
+
+    // Monitoring thread only
+    void reset()
+    {
+        for (auto &stages : m_instruments) {
+            for (LatencyHistogram &histogram : stages) {
+                histogram.reset();
+            }
+        }
+    }
+
+   private:
+    std::vector<std::array<LatencyHistogram, kLatencyStageCount>>
+        m_instruments;
+};
@@ -0,0 +1,247 @@
+#include "Logger.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <span>
+
+namespace {
+
+// How long the writer sleeps when it finds nothing to write
+constexpr auto kIdleSleep = std::chrono::microseconds(50);
+
+// @return number of {} placeholders, or std::nullopt if a brace is unmatched
+std::optional<std::size_t> countPlaceholders(std::string_view format)
+{
+    std::size_t placeholders = 0;
+    for (std::size_t i = 0; i < format.size(); ++i) {
+        char next = i + 1 < format.size() ? format[i + 1] : '\0';
+        if (format[i] == '{' && next == '}') {
+            ++placeholders;
+            ++i;
+        }
+        else if ((format[i] == '{' && next == '{') ||
+                 (format[i] == '}' && next == '}')) {
+            ++i;
+        }
+        else if (format[i] == '{' || format[i] == '}') {
+            return std::nullopt;
+        }
+    }
+    return placeholders;
+}
+
+// Append the index-th argument of message, whose text starts at *text
+void appendArg(const LogRecord &message, std::size_t index,
+               const LogRecord *&text, std::string &out)
+{
+    char digits[24];
+    std::uint64_t value = message.args[index];
+    switch (message.types[index]) {
+        case LogRecord::ArgType::SIGNED: {
+            auto end = std::to_chars(digits, std::end(digits),
+                                     static_cast<std::int64_t>(value))
+                           .ptr;
+            out.append(digits, end);
+            break;
+        }
+        case LogRecord::ArgType::UNSIGNED: {
+            auto end = std::to_chars(digits, std::end(digits), value).ptr;
+            out.append(digits, end);
+            break;
+        }
+        case LogRecord::ArgType::TEXT:
+            for (std::uint64_t remaining = value; remaining > 0; ++text) {
+                std::size_t bytes =
+                    std::min<std::uint64_t>(remaining, LogRecord::kTextBytes);
+                out.append(text->text, bytes);
+                remaining -= bytes;
+            }
+            break;
+    }
+}
+
+// Append each message of records formatted, where a message is a record
+// followed by the TEXT records of its arguments
+void formatRecords(std::span<const LogRecord> records,
+                   const std::vector<std::string> &formats, std::string &out)
+{
+    for (const LogRecord *record = records.data();
+         record != records.data() + records.size();) {
+        const LogRecord &message = *record++;
+        if (message.format >= formats.size()) {
+            out += "<unknown log format " + std::to_string(message.format) +
+                   ">\n";
+            while (record != records.data() + records.size() &&
+                   record->format == LogRecord::kText) {
+                ++record;
+            }
+            continue;
+        }
+        // Placeholders without an argument are left out
+        std::string_view format = formats[message.format];
+        std::size_t arg = 0;
+        for (std::size_t i = 0; i < format.size(); ++i) {
+            if (format[i] == '{' && i + 1 < format.size() &&
+                format[i + 1] == '}') {
+                if (arg < message.argCount) {
+                    appendArg(message, arg++, record, out);
+                }
+                ++i;
+                continue;
+            }
+            out += format[i];
+            if (format[i] == '{' || format[i] == '}') {
+                ++i;
+            }
+        }
+        // Skip the text of arguments the format has no placeholder for
+        for (; arg < message.argCount; ++arg) {
+            if (message.types[arg] == LogRecord::ArgType::TEXT) {
+                record += (message.args[arg] + LogRecord::kTextBytes - 1) /
+                          LogRecord::kTextBytes;
+            }
+        }
+    }
+}
+
+}  // namespace
+
+bool LogChannel::commit()
+{
+    bool published = m_ring.tryPushAll(m_staged);
+    if (published) {
+        m_committed += m_staged.size();
+    }
+    else {
+        m_dropped += m_stagedMessages;
+    }
+    m_staged.clear();
+    m_stagedMessages = 0;
+    return published;
+}
+
+void LogChannel::flush() const
+{
+    while (m_written.load(std::memory_order_acquire) < m_committed) {
+        std::this_thread::yield();
+    }
+}
+
+std::expected<std::unique_ptr<Logger>, std::string> Logger::Open(
+    const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        return std::unexpected("Cannot open log " + path + ": " +
+                               std::strerror(errno));
+    }
+    return std::unique_ptr<Logger>(new Logger(fd, true));
+}
+
+Logger::Logger(int fd, bool ownsFd) : m_fd(fd), m_ownsFd(ownsFd)
+{
+    m_formats = {"Instrument={}\n", "-----------------------------\n{}:\n",
+                 "Price={}\n", "{{id={}, quantity={}}} ", "\n"};
+    m_writer = std::thread([this] { run(); });
+}
+
+Logger::~Logger()
+{
+    m_stopping.store(true, std::memory_order_release);
+    m_writer.join();
+    if (m_ownsFd) {
+        ::close(m_fd);
+    }
+}
+
+std::expected<LogFormatId, std::string> Logger::defineFormat(
+    std::string format)
+{
+    auto placeholders = countPlaceholders(format);
+    if (!placeholders) {
+        return std::unexpected("Unmatched brace in log format: " + format);
+    }
+    if (*placeholders > LogRecord::kMaxArgs) {
+        return std::unexpected("Too many arguments in log format: " + format);
+    }
+    std::lock_guard lock(m_mutex);
+    if (m_formats.size() >= LogRecord::kText) {
+        return std::unexpected("Too many log formats");
+    }
+    m_formats.push_back(std::move(format));
+    return static_cast<LogFormatId>(m_formats.size() - 1);
+}
+
+LogChannel &Logger::openChannel(std::size_t capacity)
+{
+    std::lock_guard lock(m_mutex);
+    return *m_channels.emplace_back(new LogChannel(capacity));
+}
+
+void Logger::run()
+{
+    std::string text;
+    std::vector<LogRecord> records;
+    // Channels drained in this pass and how many records each
+    std::vector<std::pair<LogChannel *, std::uint64_t>> drained;
+    auto collect = [&records](const LogRecord &record) {
+        records.push_back(record);
+    };
+    while (true) {
+        // Read first, so the pass that follows the destructor's store
+        // still collects everything committed before it
+        bool stopping = m_stopping.load(std::memory_order_acquire);
+        {
+            std::lock_guard lock(m_mutex);
+            for (auto &channel : m_channels) {
+                // Commits publish whole, so a pass never splits a message
+                records.clear();
+                if (std::size_t count = channel->m_ring.popBatch(collect)) {
+                    formatRecords(records, m_formats, text);
+                    drained.emplace_back(channel.get(), count);
+                }
+            }
+        }
+        if (drained.empty()) {
+            if (stopping) {
+                return;
+            }
+            std::this_thread::sleep_for(kIdleSleep);
+            continue;
+        }
+        if (!failed()) {
+            write(text);
+        }
+        for (auto [channel, count] : drained) {
+            channel->m_written.fetch_add(count, std::memory_order_release);
+        }
+        drained.clear();
+        text.clear();
+    }
+}
+
+void Logger::write(const std::string &text)
+{
+    const char *data = text.data();
+    std::size_t remaining = text.size();
+    while (remaining > 0) {
+        ssize_t written = ::write(m_fd, data, remaining);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            m_failed.store(true, std::memory_order_release);
+            return;
+        }
+        data += written;
+        remaining -= static_cast<std::size_t>(written);
+    }
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+#include "SpscRing.hpp"
+
+// Index of a format defined with Logger::defineFormat
+using LogFormatId = std::uint16_t;
+
+// One fixed-size entry of a log channel: a format and the raw values of its
+// arguments, formatted later by the logger's thread. The bytes of text
+// arguments follow in TEXT records, in argument order.
+struct LogRecord {
+    enum class ArgType : std::uint8_t { SIGNED, UNSIGNED, TEXT };
+
+    static constexpr std::size_t kMaxArgs = 6;
+    static constexpr std::size_t kTextBytes = kMaxArgs * sizeof(std::uint64_t);
+    // Format of the records carrying the bytes of text arguments
+    static constexpr LogFormatId kText = UINT16_MAX;
+
+    LogFormatId format;
+    std::uint8_t argCount;
+    std::array<ArgType, kMaxArgs> types;
+    union {
+        std::uint64_t args[kMaxArgs];  // the length of a text argument
+        char text[kTextBytes];         // TEXT
+    };
+};
+
+static_assert(sizeof(LogRecord) == kCacheLineSize &&
+                  std::is_trivially_copyable_v<LogRecord>,
+              "log records are copied through the ring as raw bytes");
+
+class Logger;
+
+// Ring of log records from one producing thread. Logging only copies the
+// arguments into the ring; it never blocks, locks or makes a system call,
+// and only allocates to grow the staging area for a larger message than
+// before. When the logger's thread falls behind, messages that do not fit
+// are dropped and counted rather than stalling the producer.
+class LogChannel {
+   public:
+    LogChannel(const LogChannel &) = delete;
+    LogChannel &operator=(const LogChannel &) = delete;
+
+    // Stage one message to be published by the next commit. Arguments are
+    // integers, enums or anything convertible to std::string_view, whose
+    // text is copied.
+    template <typename... Args>
+    void stage(LogFormatId format, const Args &...args);
+
+    // Publish the messages staged since the last commit at once, so they
+    // are written out together, or drop all of them if they do not fit
+    // @return false if they were dropped
+    bool commit();
+
+    // Stage and commit a single message
+    // @return false if it was dropped
+    template <typename... Args>
+    bool log(LogFormatId format, const Args &...args)
+    {
+        stage(format, args...);
+        return commit();
+    }
+
+    // Block until every message committed so far has been written
+    void flush() const;
+
+    // Messages dropped for lack of room so far
+    std::uint64_t dropped() const { return m_dropped; }
+
+   private:
+    friend class Logger;
+
+    explicit LogChannel(std::size_t capacity) : m_ring(capacity) {}
+
+    template <typename T>
+    void stageArg(std::size_t message, std::size_t index, const T &arg);
+
+    SpscRing<LogRecord> m_ring;
+
+    // Only touched by the producing thread
+    std::vector<LogRecord> m_staged;
+    std::uint64_t m_stagedMessages = 0;
+    std::uint64_t m_committed = 0;
+    std::uint64_t m_dropped = 0;
+
+    // Records written out by the logger's thread
+    std::atomic<std::uint64_t> m_written{0};
+};
+
+// Writer of a log. A background thread formats the messages of every
+// channel and writes them out, so that the matching thread and any other
+// producer never wait on formatting or on the file. Messages of one channel
+// keep their order; messages of different channels are not ordered.
+class Logger {
+   public:
+    static constexpr std::size_t kDefaultChannelCapacity = 1 << 14;
+
+    // Formats every logger defines, for DumpBook
+    static constexpr LogFormatId kBookInstrument = 0;
+    static constexpr LogFormatId kBookSide = 1;
+    static constexpr LogFormatId kBookLevel = 2;
+    static constexpr LogFormatId kBookOrder = 3;
+    static constexpr LogFormatId kBookLevelEnd = 4;
+
+    // Write to fd, e.g. STDOUT_FILENO, which is left open
+    explicit Logger(int fd) : Logger(fd, false) {}
+
+    // Open path for appending, creating it if needed
+    static std::expected<std::unique_ptr<Logger>, std::string> Open(
+        const std::string &path);
+
+    // Writes out everything committed before returning. Producers must have
+    // stopped logging.
+    ~Logger();
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // Define a format from any thread before using it: text with a {} for
+    // each argument in turn, and {{ and }} for literal braces. Output is
+    // written as formatted, so formats end their lines themselves.
+    // @return id to log the format with or descriptive error
+    std::expected<LogFormatId, std::string> defineFormat(std::string format);
+
+    // Open a channel for the calling thread to log through, from any
+    // thread. It lives as long as the logger; a message staged as one
+    // commit must fit in capacity records.
+    LogChannel &openChannel(std::size_t capacity = kDefaultChannelCapacity);
+
+    // True once a write failed, later messages are discarded
+    bool failed() const { return m_failed.load(std::memory_order_acquire); }
+
+   private:
+    Logger(int fd, bool ownsFd);
+
+    void run();
+    void write(const std::string &text);
+
+    int m_fd;
+    bool m_ownsFd;
+
+    // Guards the channels and the formats against the background thread
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<LogChannel>> m_channels;
+    std::vector<std::string> m_formats;
+
+    std::atomic<bool> m_failed{false};
+    std::atomic<bool> m_stopping{false};
+    std::thread m_writer;
+};
+
+template <typename... Args>
+void LogChannel::stage(LogFormatId format, const Args &...args)
+{
+    static_assert(sizeof...(Args) <= LogRecord::kMaxArgs,
+                  "too many arguments for one log record");
+    std::size_t message = m_staged.size();
+    LogRecord &record = m_staged.emplace_back();
+    record.format = format;
+    record.argCount = sizeof...(Args);
+    if constexpr (sizeof...(Args) != 0) {
+        std::size_t index = 0;
+        (stageArg(message, index++, args), ...);
+    }
+    ++m_stagedMessages;
+}
+
+template <typename T>
+void LogChannel::stageArg(std::size_t message, std::size_t index,
+                          const T &arg)
+{
+    // Text records are appended behind the message, which may move it
+    if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        std::string_view text = arg;
+        m_staged[message].types[index] = LogRecord::ArgType::TEXT;
+        m_staged[message].args[index] = text.size();
+        for (std::size_t offset = 0; offset < text.size();
+             offset += LogRecord::kTextBytes) {
+            LogRecord &chunk = m_staged.emplace_back();
+            chunk.format = LogRecord::kText;
+            text.copy(chunk.text, LogRecord::kTextBytes, offset);
+        }
+    }
+    else if constexpr (std::is_enum_v<T>) {
+        stageArg(message, index, std::to_underlying(arg));
+    }
+    else {
+        static_assert(std::is_integral_v<T>,
+                      "log arguments are integers, enums or text");
+        LogRecord &record = m_staged[message];
+        if constexpr (std::is_signed_v<T>) {
+            record.types[index] = LogRecord::ArgType::SIGNED;
+            record.args[index] =
+                static_cast<std::uint64_t>(static_cast<std::int64_t>(arg));
+        }
+        else {
+            record.types[index] = LogRecord::ArgType::UNSIGNED;
+            record.args[index] = static_cast<std::uint64_t>(arg);
+        }
+    }
+}
+
+// Snapshot a book into channel, laid out like printInstrumentBooks, and
+// publish it as one commit to be formatted off the calling thread. The
+// staging area keeps its size between dumps, so dumping a book no larger
+// than the last one does not allocate.
+// @return false if the channel had no room for the whole book, which is
+// then dropped
+template <ExchangeListener Listener>
+bool DumpBook(LogChannel &channel, const BasicExchange<Listener> &exchange,
+              InstrumentId instrument)
+{
+    channel.stage(Logger::kBookInstrument,
+                  exchange.instrumentName(instrument));
+    for (Side side : {Side::BUY, Side::SELL}) {
+        channel.stage(Logger::kBookSide, side == Side::BUY ? "Bids" : "Asks");
+        bool inLevel = false;
+        std::int64_t levelPrice = 0;
+        exchange.forEachOrder(
+            instrument, side,
+            [&](std::uint64_t orderId, std::int64_t price,
+                std::uint32_t quantity, AccountId) {
+                if (!inLevel || price != levelPrice) {
+                    if (inLevel) {
+                        channel.stage(Logger::kBookLevelEnd);
+                    }
+                    channel.stage(Logger::kBookLevel, price);
+                    inLevel = true;
+                    levelPrice = price;
+                }
+                channel.stage(Logger::kBookOrder, orderId, quantity);
+            });
+        if (inLevel) {
+            channel.stage(Logger::kBookLevelEnd);
+        }
+    }
+    return channel.commit();
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+
+// One fixed-layout L2 market data message. Messages hold no pointers, so a
+// packet of them can be copied as is into shared memory or sent as the
+// payload of one UDP datagram.
+//
+// Every level update of an instrument increments its sequence, which lets
+// consumers detect gaps. A full-depth snapshot of an instrument is sent as
+// SNAPSHOT_BEGIN, one SNAPSHOT_LEVEL per level (bids then asks, best first)
+// and SNAPSHOT_END, all carrying the sequence of the last update they
+// include: consumers joining late apply the snapshot and then the updates
+// numbered after it.
+struct MarketDataMessage {
+    enum class Type : std::uint8_t {
+        LEVEL_ADD,
+        LEVEL_CHANGE,
+        LEVEL_DELETE,
+        SNAPSHOT_BEGIN,
+        SNAPSHOT_LEVEL,
+        SNAPSHOT_END
+    };
+
+    Type type;
+    Side side;  // level messages only
+    InstrumentId instrument;
+    std::uint64_t sequence;
+    std::int64_t price;      // level messages only
+    std::uint32_t quantity;  // total at price, 0 for LEVEL_DELETE
+};
+
+static_assert(sizeof(MarketDataMessage) == 32 &&
+                  std::is_trivially_copyable_v<MarketDataMessage>,
+              "market data messages are published as raw bytes");
+
+// Encoder of level updates and snapshots into packets of MarketDataMessage.
+// A packet goes to the sink once it is full or on flush(); Exchange flushes
+// after every command, so each packet holds the updates of whole commands
+// unless one command overflows it.
+class MarketDataPublisher {
+   public:
+    using Sink = std::function<void(std::span<const MarketDataMessage>)>;
+
+    // Fills the 1472 byte UDP payload of a standard Ethernet frame
+    static constexpr std::size_t kDefaultPacketMessages =
+        1472 / sizeof(MarketDataMessage);
+
+    explicit MarketDataPublisher(
+        Sink sink, std::size_t packetMessages = kDefaultPacketMessages)
+        : m_sink(std::move(sink)),
+          m_packetMessages(packetMessages != 0 ? packetMessages : 1)
+    {
+        m_packet.reserve(m_packetMessages);
+    }
+
+    void publishLevel(InstrumentId instrument, Side side, LevelAction action,
+                      std::int64_t price, std::uint32_t quantity)
+    {
+        MarketDataMessage::Type type = MarketDataMessage::Type::LEVEL_CHANGE;
+        if (action == LevelAction::ADD) {
+            type = MarketDataMessage::Type::LEVEL_ADD;
+        }
+        else if (action == LevelAction::DELETE) {
+            type = MarketDataMessage::Type::LEVEL_DELETE;
+        }
+        append({type, side, instrument, ++sequenceOf(instrument), price,
+                quantity});
+    }
+
+    void beginSnapshot(InstrumentId instrument)
+    {
+        append({MarketDataMessage::Type::SNAPSHOT_BEGIN, Side::BUY,
+                instrument, sequenceOf(instrument), 0, 0});
+    }
+
+    void snapshotLevel(InstrumentId instrument, Side side, std::int64_t price,
+                       std::uint32_t quantity)
+    {
+        append({MarketDataMessage::Type::SNAPSHOT_LEVEL, side, instrument,
+                sequenceOf(instrument), price, quantity});
+    }
+
+    void endSnapshot(InstrumentId instrument)
+    {
+        append({MarketDataMessage::Type::SNAPSHOT_END, Side::BUY, instrument,
+                sequenceOf(instrument), 0, 0});
+    }
+
+    // Hand the messages buffered so far to the sink as one packet
+    void flush()
+    {
+        if (!m_packet.empty()) {
+            m_sink(m_packet);
+            m_packet.clear();
+        }
+    }
+
+    // Sequence of the last update published for instrument
+    std::uint64_t sequence(InstrumentId instrument) const
+    {
+        return instrument < m_sequences.size() ? m_sequences[instrument] : 0;
+    }
+
+   private:
+    Sink m_sink;
+    std::size_t m_packetMessages;
+    std::vector<MarketDataMessage> m_packet;
+    // Indexed by InstrumentId
+    std::vector<std::uint64_t> m_sequences;
+
+    void append(const MarketDataMessage &message)
+    {
+        m_packet.push_back(message);
+        if (m_packet.size() == m_packetMessages) {
+            flush();
+        }
+    }
+
+    std::uint64_t &sequenceOf(InstrumentId instrument)
+    {
+        if (instrument >= m_sequences.size()) {
+            m_sequences.resize(instrument + 1);
+        }
+        return m_sequences[instrument];
+    }
+};
+
+// Publish a full-depth snapshot of every book of exchange and flush it
+template <ExchangeListener Listener>
+void PublishDepthSnapshot(const BasicExchange<Listener> &exchange,
+                          MarketDataPublisher &publisher)
+{
+    for (InstrumentId id = 0; id < exchange.instrumentCount(); ++id) {
+        publisher.beginSnapshot(id);
+        for (Side side : {Side::BUY, Side::SELL}) {
+            exchange.forEachLevel(
+                id, side, [&](std::int64_t price, std::uint32_t quantity) {
+                    publisher.snapshotLevel(id, side, price, quantity);
+                });
+        }
+        publisher.endSnapshot(id);
+    }
+    publisher.flush();
+}
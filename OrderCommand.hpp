@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+#include "IExchange.hpp"
+#include "SpscRing.hpp"
+
+// Fixed-size order entry command, written by a gateway thread into a
+// CommandRing and drained by the matching thread with
+// Exchange::ProcessCommands. ADD commands carry the id chosen by the
+// gateway, see Exchange::AddOrderWithId.
+struct OrderCommand {
+    enum class Type : std::uint8_t { ADD, CANCEL, MODIFY };
+
+    std::uint64_t orderId;
+    std::int64_t price;  // ADD and MODIFY only
+    InstrumentId instrument;
+    std::uint32_t quantity;  // ADD and MODIFY only
+    Side side;
+    Type type;
+    TimeInForce timeInForce;  // ADD only
+    OrderType orderType;      // ADD only
+    AccountId account;        // ADD only
+};
+
+static_assert(sizeof(OrderCommand) == 32,
+              "two commands per cache line, keep the layout packed");
+
+using CommandRing = SpscRing<OrderCommand>;
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "FlatHashMap.hpp"
+#include "IExchange.hpp"
+#include "OrderCommand.hpp"
+
+// Binary order entry protocol. A buffer holds back to back messages, each an
+// OrderEntryHeader followed by a fixed-layout body of header.blockLength
+// bytes. Fields are little-endian and the structs below are the exact wire
+// layout, so messages are decoded straight out of the receive buffer.
+static_assert(std::endian::native == std::endian::little,
+              "order entry messages are read in host byte order");
+
+struct OrderEntryHeader {
+    static constexpr std::uint16_t kSchemaId = 1;
+    static constexpr std::uint16_t kVersion = 1;
+
+    std::uint16_t blockLength;
+    std::uint16_t templateId;
+    std::uint16_t schemaId;
+    std::uint16_t version;
+};
+
+// client tags are echoed back with each message's result
+struct NewOrderMessage {
+    static constexpr std::uint16_t kTemplateId = 1;
+
+    std::uint64_t clientTag;
+    // NUL padded if shorter
+    char symbol[8];
+    std::int64_t price;  // ignored for market orders
+    std::uint32_t quantity;
+    Side side;
+    TimeInForce timeInForce;
+    OrderType type;
+    std::uint8_t reserved;
+};
+
+struct CancelOrderMessage {
+    static constexpr std::uint16_t kTemplateId = 2;
+
+    std::uint64_t clientTag;
+    std::uint64_t orderId;
+};
+
+struct ModifyOrderMessage {
+    static constexpr std::uint16_t kTemplateId = 3;
+
+    std::uint64_t clientTag;
+    std::uint64_t orderId;
+    std::int64_t price;
+    std::uint32_t quantity;
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(OrderEntryHeader) == 8 &&
+                  sizeof(NewOrderMessage) == 32 &&
+                  sizeof(CancelOrderMessage) == 16 &&
+                  sizeof(ModifyOrderMessage) == 32,
+              "order entry structs are the wire layout");
+static_assert(std::is_trivially_copyable_v<NewOrderMessage> &&
+                  std::is_trivially_copyable_v<CancelOrderMessage> &&
+                  std::is_trivially_copyable_v<ModifyOrderMessage>,
+              "order entry messages are read as raw bytes");
+
+// What the decoder drives, e.g. Exchange or a BasicExchange
+template <typename T>
+concept OrderEntryTarget =
+    requires(T &target, const std::string &name, InstrumentId instrument,
+             Side side, std::uint64_t orderId, std::int64_t price,
+             std::uint32_t quantity, TimeInForce timeInForce, OrderType type,
+             AccountId account) {
+        {
+            target.findInstrument(name)
+        } -> std::same_as<std::optional<InstrumentId>>;
+        {
+            target.AddOrder(instrument, side, price, quantity, timeInForce,
+                            type, account)
+        } -> std::same_as<std::expected<std::uint64_t, std::string>>;
+        {
+            target.orderAccount(orderId)
+        } -> std::same_as<std::optional<AccountId>>;
+        { target.RemoveOrder(orderId) } -> std::same_as<bool>;
+        { target.MassCancel(account) } -> std::same_as<std::size_t>;
+        {
+            target.ModifyOrder(orderId, price, quantity)
+        } -> std::same_as<std::expected<std::uint64_t, std::string>>;
+    };
+
+// One order entry message decoded but not yet applied, see
+// OrderEntryDecoder::decodeNext
+struct DecodedOrderEntry {
+    std::uint64_t clientTag;
+    // ADD carries everything but the order id, CANCEL the order id, MODIFY
+    // the order id, price and quantity, and all of them the session's
+    // account. The instrument and side of CANCEL and MODIFY are left to the
+    // target to look up.
+    OrderCommand command;
+    // Set instead when the message cannot be applied, the reply to send
+    const char *rejection;
+};
+
+// Apply a decoded message to target. Cancels and modifies of an order
+// resting under another account are rejected as if it did not exist.
+// @return order id or why it was rejected, the reply to send
+template <OrderEntryTarget Target>
+std::expected<std::uint64_t, std::string> ApplyOrderEntry(
+    Target &target, const DecodedOrderEntry &message);
+
+// Decodes order entry messages in place and applies each one to the target
+// as it goes. Symbols resolve through a cache keyed by their 8 raw bytes, so
+// only the first order of an instrument builds a std::string; instruments
+// must be registered with the target beforehand.
+template <OrderEntryTarget Target>
+class OrderEntryDecoder {
+   public:
+    // New orders are entered under the session's account
+    explicit OrderEntryDecoder(Target &target, AccountId account = 0)
+        : m_target(target), m_account(account)
+    {
+    }
+
+    // Apply every complete message of buffer in order, calling
+    // reply(clientTag, result) after each with the order id or why it was
+    // rejected. A trailing partial message is left for the next call.
+    // @return bytes consumed or descriptive error if the stream is malformed,
+    // in which case the messages before the bad one have been applied
+    template <typename Reply>
+        requires std::invocable<Reply &, std::uint64_t,
+                                std::expected<std::uint64_t, std::string>>
+    std::expected<std::size_t, std::string> decode(
+        std::span<const std::byte> buffer, Reply &&reply);
+
+    // Decode the first message of buffer into message without applying it,
+    // for a caller that applies it later with ApplyOrderEntry
+    // @return bytes of the message, 0 if buffer holds no complete message,
+    // or descriptive error if the stream is malformed
+    std::expected<std::size_t, std::string> decodeNext(
+        std::span<const std::byte> buffer, DecodedOrderEntry &message);
+
+    // Cancel every resting order of the session's account, for when its
+    // connection drops
+    // @return number of orders cancelled
+    std::size_t cancelAll() { return m_target.MassCancel(m_account); }
+
+   private:
+    Target &m_target;
+    AccountId m_account;
+    FlatHashMap<std::uint64_t /* symbol bytes */, InstrumentId> m_symbols;
+
+    std::optional<InstrumentId> resolve(const char (&symbol)[8]);
+
+    template <typename Message>
+    static Message read(const std::byte *body)
+    {
+        // Compiles to plain loads, the buffer need not be aligned
+        Message message;
+        std::memcpy(&message, body, sizeof(message));
+        return message;
+    }
+
+    static bool valid(const NewOrderMessage &message)
+    {
+        return static_cast<std::uint8_t>(message.side) <= 1 &&
+               static_cast<std::uint8_t>(message.timeInForce) <= 2 &&
+               static_cast<std::uint8_t>(message.type) <= 1;
+    }
+};
+
+template <OrderEntryTarget Target>
+template <typename Reply>
+    requires std::invocable<Reply &, std::uint64_t,
+                            std::expected<std::uint64_t, std::string>>
+std::expected<std::size_t, std::string> OrderEntryDecoder<Target>::decode(
+    std::span<const std::byte> buffer, Reply &&reply)
+{
+    std::size_t offset = 0;
+    DecodedOrderEntry message;
+    while (true) {
+        auto size = decodeNext(buffer.subspan(offset), message);
+        if (!size) {
+            return std::unexpected(std::move(size.error()));
+        }
+        if (*size == 0) {
+            return offset;
+        }
+        reply(message.clientTag, ApplyOrderEntry(m_target, message));
+        offset += *size;
+    }
+}
+
+template <OrderEntryTarget Target>
+std::expected<std::size_t, std::string> OrderEntryDecoder<Target>::decodeNext(
+    std::span<const std::byte> buffer, DecodedOrderEntry &message)
+{
+    if (buffer.size() < sizeof(OrderEntryHeader)) {
+        return 0;
+    }
+    auto header = read<OrderEntryHeader>(buffer.data());
+    if (header.schemaId != OrderEntryHeader::kSchemaId ||
+        header.version != OrderEntryHeader::kVersion) {
+        return std::unexpected("Unsupported order entry schema");
+    }
+    std::size_t size = sizeof(OrderEntryHeader) + header.blockLength;
+    if (buffer.size() < size) {
+        return 0;
+    }
+    const std::byte *body = buffer.data() + sizeof(OrderEntryHeader);
+    message.command = OrderCommand{};
+    message.rejection = nullptr;
+    switch (header.templateId) {
+        case NewOrderMessage::kTemplateId: {
+            if (header.blockLength != sizeof(NewOrderMessage)) {
+                return std::unexpected("Bad order entry block length");
+            }
+            auto entry = read<NewOrderMessage>(body);
+            message.clientTag = entry.clientTag;
+            if (!valid(entry)) {
+                message.rejection = "Malformed new order";
+                break;
+            }
+            std::optional<InstrumentId> instrument = resolve(entry.symbol);
+            if (!instrument) {
+                message.rejection = "Unknown instrument";
+                break;
+            }
+            message.command.type = OrderCommand::Type::ADD;
+            message.command.instrument = *instrument;
+            message.command.side = entry.side;
+            message.command.price = entry.price;
+            message.command.quantity = entry.quantity;
+            message.command.timeInForce = entry.timeInForce;
+            message.command.orderType = entry.type;
+            message.command.account = m_account;
+            break;
+        }
+        case CancelOrderMessage::kTemplateId: {
+            if (header.blockLength != sizeof(CancelOrderMessage)) {
+                return std::unexpected("Bad order entry block length");
+            }
+            auto entry = read<CancelOrderMessage>(body);
+            message.clientTag = entry.clientTag;
+            message.command.type = OrderCommand::Type::CANCEL;
+            message.command.orderId = entry.orderId;
+            message.command.account = m_account;
+            break;
+        }
+        case ModifyOrderMessage::kTemplateId: {
+            if (header.blockLength != sizeof(ModifyOrderMessage)) {
+                return std::unexpected("Bad order entry block length");
+            }
+            auto entry = read<ModifyOrderMessage>(body);
+            message.clientTag = entry.clientTag;
+            message.command.type = OrderCommand::Type::MODIFY;
+            message.command.orderId = entry.orderId;
+            message.command.price = entry.price;
+            message.command.quantity = entry.quantity;
+            message.command.account = m_account;
+            break;
+        }
+        default:
+            return std::unexpected("Unknown order entry template");
+    }
+    return size;
+}
+
+template <OrderEntryTarget Target>
+std::expected<std::uint64_t, std::string> ApplyOrderEntry(
+    Target &target, const DecodedOrderEntry &message)
+{
+    if (message.rejection != nullptr) {
+        return std::unexpected(message.rejection);
+    }
+    const OrderCommand &command = message.command;
+    switch (command.type) {
+        case OrderCommand::Type::ADD:
+            return target.AddOrder(command.instrument, command.side,
+                                   command.price, command.quantity,
+                                   command.timeInForce, command.orderType,
+                                   command.account);
+        case OrderCommand::Type::CANCEL:
+            if (target.orderAccount(command.orderId) == command.account &&
+                target.RemoveOrder(command.orderId)) {
+                return command.orderId;
+            }
+            return std::unexpected("Unknown order");
+        case OrderCommand::Type::MODIFY:
+            if (target.orderAccount(command.orderId) != command.account) {
+                return std::unexpected("Unknown order");
+            }
+            return target.ModifyOrder(command.orderId, command.price,
+                                      command.quantity);
+    }
+    return std::unexpected("Unknown order entry command");
+}
+
+template <OrderEntryTarget Target>
+std::optional<InstrumentId> OrderEntryDecoder<Target>::resolve(
+    const char (&symbol)[8])
+{
+    std::uint64_t key = 0;
+    std::memcpy(&key, symbol, sizeof(key));
+    if (auto iter = m_symbols.find(key); iter != m_symbols.end()) {
+        return iter->second;
+    }
+    std::optional<InstrumentId> instrument = m_target.findInstrument(
+        std::string(symbol, ::strnlen(symbol, sizeof(symbol))));
+    if (instrument) {
+        m_symbols.try_emplace(key, *instrument);
+    }
+    return instrument;
+}
@@ -0,0 +1,196 @@
+#include "ParallelReplay.hpp"
+
+#include <algorithm>
+#include <barrier>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Journal.hpp"
+
+namespace {
+
+struct SequencedEvent {
+    // Journal record whose command produced the event
+    std::uint64_t record;
+    ExchangeEvent event;
+};
+
+// Records a worker's events tagged with their record, under the journal's
+// instrument ids
+struct ReplayListener {
+    std::vector<SequencedEvent> *events = nullptr;
+    const std::vector<InstrumentId> *journalIds = nullptr;
+    std::uint64_t record = 0;
+
+    void OnOrderTraded(InstrumentId instrument, std::uint64_t orderId,
+                       std::int64_t tradedPrice, std::uint32_t tradedQuantity)
+    {
+        events->push_back(
+            {record, ExchangeEvent{ExchangeEvent::Type::ORDER_TRADED,
+                                   (*journalIds)[instrument], orderId,
+                                   tradedPrice, tradedQuantity, 0, 0}});
+    }
+
+    void OnBestPriceChanged(InstrumentId instrument, std::int64_t bidPrice,
+                            std::uint32_t bidTotalQuantity,
+                            std::int64_t askPrice,
+                            std::uint32_t askTotalQuantity)
+    {
+        events->push_back(
+            {record, ExchangeEvent{ExchangeEvent::Type::BEST_PRICE_CHANGED,
+                                   (*journalIds)[instrument], 0, bidPrice,
+                                   bidTotalQuantity, askTotalQuantity,
+                                   askPrice}});
+    }
+};
+
+struct Worker {
+    Worker(JournalReader journal, std::size_t partition,
+           std::size_t partitions, const ExchangeConfig &config)
+        : reader(std::move(journal)),
+          exchange(ReplayListener{}, config),
+          applier(exchange, partition, partitions)
+    {
+        exchange.listener().journalIds = &applier.journalIds();
+    }
+
+    JournalReader reader;
+    BasicExchange<ReplayListener> exchange;
+    JournalApplier<ReplayListener> applier;
+
+    // Events of the chunk being replayed and of the one being merged,
+    // alternating by chunk
+    std::vector<SequencedEvent> events[2];
+    std::uint64_t nextRecord = 0;
+    std::string error;
+    // Set at the end of the journal or on the first error
+    bool done = false;
+
+    void replayChunk(std::size_t chunk)
+    {
+        std::vector<SequencedEvent> &buffer = events[chunk % 2];
+        buffer.clear();
+        exchange.listener().events = &buffer;
+        auto records = reader.next();
+        if (!records || records->empty()) {
+            error = records ? std::string{} : std::move(records.error());
+            done = true;
+            return;
+        }
+        for (const JournalRecord &record : *records) {
+            exchange.listener().record = nextRecord++;
+            if (auto applied = applier.apply(record); !applied) {
+                error = std::move(applied.error());
+                done = true;
+                return;
+            }
+        }
+    }
+};
+
+// Merge the workers' events of one chunk into record order. Each record's
+// events all come from the worker owning its instrument.
+void mergeChunk(const std::vector<std::unique_ptr<Worker>> &workers,
+                std::size_t chunk, std::vector<std::size_t> &positions,
+                std::vector<ExchangeEvent> &merged)
+{
+    merged.clear();
+    std::fill(positions.begin(), positions.end(), 0);
+    while (true) {
+        const std::vector<SequencedEvent> *next = nullptr;
+        std::size_t *position = nullptr;
+        for (std::size_t i = 0; i < workers.size(); ++i) {
+            const auto &events = workers[i]->events[chunk % 2];
+            if (positions[i] < events.size() &&
+                (next == nullptr ||
+                 events[positions[i]].record < (*next)[*position].record)) {
+                next = &events;
+                position = &positions[i];
+            }
+        }
+        if (next == nullptr) {
+            return;
+        }
+        std::uint64_t record = (*next)[*position].record;
+        while (*position < next->size() &&
+               (*next)[*position].record == record) {
+            merged.push_back((*next)[(*position)++].event);
+        }
+    }
+}
+
+}  // namespace
+
+std::expected<std::uint64_t, std::string> ParallelReplayJournal(
+    const std::string &path, std::size_t threads, const ReplaySink &sink,
+    const ExchangeConfig &config)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+    std::vector<std::unique_ptr<Worker>> workers;
+    workers.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i) {
+        auto reader = JournalReader::Open(path);
+        if (!reader) {
+            return std::unexpected(reader.error());
+        }
+        workers.push_back(
+            std::make_unique<Worker>(std::move(*reader), i, threads, config));
+    }
+
+    // Decided once per chunk, before anyone moves on to the next
+    bool stopping = false;
+    std::barrier chunkReplayed(
+        static_cast<std::ptrdiff_t>(threads + 1), [&]() noexcept {
+            stopping = std::ranges::any_of(
+                workers, [](const auto &worker) { return worker->done; });
+        });
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads);
+    for (auto &worker : workers) {
+        pool.emplace_back([&, &worker = *worker] {
+            for (std::size_t chunk = 0;; ++chunk) {
+                worker.replayChunk(chunk);
+                chunkReplayed.arrive_and_wait();
+                if (stopping) {
+                    return;
+                }
+            }
+        });
+    }
+
+    // Merging chunk n overlaps the workers replaying chunk n + 1 into their
+    // other buffers
+    std::vector<std::size_t> positions(threads);
+    std::vector<ExchangeEvent> merged;
+    for (std::size_t chunk = 0;; ++chunk) {
+        chunkReplayed.arrive_and_wait();
+        if (stopping) {
+            break;
+        }
+        mergeChunk(workers, chunk, positions, merged);
+        if (!merged.empty()) {
+            sink(merged);
+        }
+    }
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+
+    std::uint64_t commands = 0;
+    for (auto &worker : workers) {
+        if (!worker->error.empty()) {
+            return std::unexpected(std::move(worker->error));
+        }
+        auto replayed = worker->applier.finish();
+        if (!replayed) {
+            return std::unexpected(std::move(replayed.error()));
+        }
+        commands += *replayed;
+    }
+    return commands;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <span>
+#include <string>
+
+#include "BasicExchange.hpp"
+#include "EventBuffer.hpp"
+
+// Receives the events of a replay a run at a time, in the order a serial
+// replay of the same journal would have produced them
+using ReplaySink = std::function<void(std::span<const ExchangeEvent>)>;
+
+// Replay a journal from its start into fresh books, for backtesting over
+// recorded order flow. Instruments are split across threads workers by
+// journal id modulo threads, each with private books, and every worker
+// reads the whole journal but only replays its own instruments. Workers
+// step through the journal one chunk at a time in lockstep; the calling
+// thread merges each chunk's events back into record order and hands them
+// to sink while the workers replay the next one. Books of different
+// instruments never interact, so the merged stream is identical to that of
+// ReplayJournal into a single exchange, nothing is checked against risk
+// limits, and events carry the journal's instrument ids.
+// @return number of orders added, cancelled and modified, or descriptive
+// error
+std::expected<std::uint64_t, std::string> ParallelReplayJournal(
+    const std::string &path, std::size_t threads, const ReplaySink &sink,
+    const ExchangeConfig &config = {});
@@ -0,0 +1,211 @@
+#include "Pipeline.hpp"
+
+#include <algorithm>
+#include <utility>
+
+void SessionPipeline::Listener::OnOrderAccepted(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t price, std::uint32_t quantity, TimeInForce timeInForce,
+    OrderType type, AccountId account)
+{
+    if (journal != nullptr) {
+        commands.push_back({orderId, price, instrument, quantity, side,
+                            OrderCommand::Type::ADD, timeInForce, type,
+                            account});
+    }
+}
+
+void SessionPipeline::Listener::OnOrderCancelled(InstrumentId instrument,
+                                                 Side side,
+                                                 std::uint64_t orderId)
+{
+    if (journal != nullptr) {
+        commands.push_back({orderId, 0, instrument, 0, side,
+                            OrderCommand::Type::CANCEL, TimeInForce::GTC,
+                            OrderType::LIMIT, 0});
+    }
+}
+
+void SessionPipeline::Listener::OnOrderModified(InstrumentId instrument,
+                                                Side side,
+                                                std::uint64_t orderId,
+                                                std::int64_t price,
+                                                std::uint32_t quantity)
+{
+    if (journal != nullptr) {
+        commands.push_back({orderId, price, instrument, quantity, side,
+                            OrderCommand::Type::MODIFY, TimeInForce::GTC,
+                            OrderType::LIMIT, 0});
+    }
+}
+
+SessionPipeline::SessionPipeline(PipelineSinks sinks,
+                                 const PipelineConfig &config)
+    : m_sinks(std::move(sinks)),
+      m_engine(Listener{}, config.exchange),
+      m_decoder(m_engine, config.account),
+      m_inputCapacity(config.inputBytes != 0 ? config.inputBytes : 1),
+      m_commands(m_scheduler, config.commands, statsOf(PipelineStage::MATCH)),
+      m_outputs(m_scheduler, config.outputs, statsOf(PipelineStage::PUBLISH)),
+      m_journalCommands(m_scheduler, config.journalCommands,
+                        statsOf(PipelineStage::JOURNAL))
+{
+    m_input.reserve(m_inputCapacity);
+    statsOf(PipelineStage::DECODE).queueCapacity = m_inputCapacity;
+    m_stages.reserve(kPipelineStages);
+    m_stages.push_back(decode());
+    m_stages.push_back(match());
+    m_stages.push_back(publish());
+    m_stages.push_back(journal());
+    // Let every stage run up to its first wait
+    for (const StageTask &stage : m_stages) {
+        m_scheduler.schedule(stage.handle());
+    }
+    m_scheduler.run();
+}
+
+std::expected<std::size_t, std::string> SessionPipeline::Feed(
+    std::span<const std::byte> bytes)
+{
+    if (!m_error.empty()) {
+        return std::unexpected(m_error);
+    }
+    // The decoder is between messages whenever it lets the caller run
+    m_input.erase(m_input.begin(),
+                  m_input.begin() + static_cast<std::ptrdiff_t>(m_inputStart));
+    m_inputStart = 0;
+    std::size_t taken =
+        std::min(bytes.size(), m_inputCapacity - m_input.size());
+    m_input.insert(m_input.end(), bytes.begin(),
+                   bytes.begin() + static_cast<std::ptrdiff_t>(taken));
+    StageStats &stats = statsOf(PipelineStage::DECODE);
+    stats.queueDepth = m_input.size();
+    stats.maxQueueDepth = std::max(stats.maxQueueDepth, stats.queueDepth);
+
+    m_inputReady.notify(m_scheduler);
+    m_scheduler.run();
+    if (!m_error.empty()) {
+        return std::unexpected(m_error);
+    }
+    return taken;
+}
+
+bool SessionPipeline::idle() const
+{
+    return m_commands.empty() && m_outputs.empty() &&
+           m_journalCommands.empty() && !m_scheduler.hasDeferred();
+}
+
+StageTask SessionPipeline::decode()
+{
+    StageStats &stats = statsOf(PipelineStage::DECODE);
+    DecodedOrderEntry message;
+    while (true) {
+        auto size = m_decoder.decodeNext(
+            std::span(m_input).subspan(m_inputStart), message);
+        if (!size) {
+            m_error = std::move(size.error());
+            m_input.clear();
+            m_inputStart = 0;
+            stats.queueDepth = 0;
+            co_return;
+        }
+        if (*size == 0) {
+            co_await m_inputReady.wait();
+            continue;
+        }
+        m_inputStart += *size;
+        stats.queueDepth = m_input.size() - m_inputStart;
+        co_await m_commands.push(message, stats);
+        ++stats.processed;
+    }
+}
+
+StageTask SessionPipeline::match()
+{
+    StageStats &stats = statsOf(PipelineStage::MATCH);
+    Listener &listener = m_engine.listener();
+    Output output;
+    while (true) {
+        DecodedOrderEntry message = co_await m_commands.pop();
+        auto result = ApplyOrderEntry(m_engine, message);
+        // Hand on what the command produced before taking the next one, so
+        // the books never run ahead of the queues behind them
+        for (const ExchangeEvent &event : listener.events.events()) {
+            output = event;
+            co_await m_outputs.push(output, stats);
+        }
+        listener.events.clear();
+        output = Reply{message.clientTag, std::move(result)};
+        co_await m_outputs.push(output, stats);
+        for (OrderCommand &command : listener.commands) {
+            co_await m_journalCommands.push(command, stats);
+        }
+        listener.commands.clear();
+        ++stats.processed;
+    }
+}
+
+StageTask SessionPipeline::publish()
+{
+    StageStats &stats = statsOf(PipelineStage::PUBLISH);
+    Output output;
+    while (true) {
+        output = co_await m_outputs.pop();
+        if (auto *reply = std::get_if<Reply>(&output)) {
+            while (m_sinks.replies &&
+                   !m_sinks.replies(reply->clientTag, reply->result)) {
+                co_await m_scheduler.nextRun(stats);
+            }
+            ++stats.processed;
+            continue;
+        }
+        // Events already queued behind this one go out in the same run
+        m_batch.clear();
+        m_batch.push_back(std::get<ExchangeEvent>(output));
+        while (m_outputs.front() != nullptr &&
+               std::holds_alternative<ExchangeEvent>(*m_outputs.front())) {
+            m_outputs.tryPop(output);
+            m_batch.push_back(std::get<ExchangeEvent>(output));
+        }
+        while (m_sinks.events && !m_sinks.events(m_batch)) {
+            co_await m_scheduler.nextRun(stats);
+        }
+        stats.processed += m_batch.size();
+    }
+}
+
+StageTask SessionPipeline::journal()
+{
+    StageStats &stats = statsOf(PipelineStage::JOURNAL);
+    while (true) {
+        OrderCommand command = co_await m_journalCommands.pop();
+        Journal *journal = m_engine.listener().journal;
+        // Wait for room rather than let Journal spin the thread until its
+        // writer catches up
+        while (journal != nullptr && !journal->canAppend(1)) {
+            co_await m_scheduler.nextRun(stats);
+            journal = m_engine.listener().journal;
+        }
+        if (journal != nullptr) {
+            switch (command.type) {
+                case OrderCommand::Type::ADD:
+                    journal->recordAdd(command.instrument, command.side,
+                                       command.orderId, command.price,
+                                       command.quantity, command.timeInForce,
+                                       command.orderType, command.account);
+                    break;
+                case OrderCommand::Type::CANCEL:
+                    journal->recordCancel(command.instrument, command.side,
+                                          command.orderId);
+                    break;
+                case OrderCommand::Type::MODIFY:
+                    journal->recordModify(command.instrument, command.side,
+                                          command.orderId, command.price,
+                                          command.quantity);
+                    break;
+            }
+        }
+        ++stats.processed;
+    }
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "EventBuffer.hpp"
+#include "IExchange.hpp"
+#include "Journal.hpp"
+#include "OrderCommand.hpp"
+#include "OrderEntry.hpp"
+#include "PreTradeRisk.hpp"
+#include "PriceLevels.hpp"
+#include "StageQueue.hpp"
+
+// Stages of a SessionPipeline, in the order messages flow through them
+enum class PipelineStage : std::uint8_t { DECODE, MATCH, PUBLISH, JOURNAL };
+
+inline constexpr std::size_t kPipelineStages = 4;
+
+// Where a SessionPipeline delivers its output. A sink returns false when it
+// cannot take what it is handed yet, e.g. because a socket buffer or a ring
+// to another thread is full; its stage then retries on the next Poll and
+// stops taking input meanwhile. Unset sinks discard their output.
+struct PipelineSinks {
+    // Fills and best price changes, a run of them at a time
+    std::function<bool(std::span<const ExchangeEvent>)> events;
+    // The result of every message in message order, after its events: the
+    // order's id or why it was rejected
+    std::function<bool(std::uint64_t clientTag,
+                       const std::expected<std::uint64_t, std::string> &)>
+        replies;
+};
+
+// Queue sizes of a SessionPipeline, fixed at construction
+struct PipelineConfig {
+    // Order entry bytes buffered ahead of the decoder
+    std::size_t inputBytes = 64 * 1024;
+    // Decoded messages waiting to be matched
+    std::size_t commands = 1024;
+    // Events and replies waiting to be published
+    std::size_t outputs = 4096;
+    // Accepted commands waiting to be journaled
+    std::size_t journalCommands = 4096;
+    // New orders are entered under the session's account
+    AccountId account = 0;
+    ExchangeConfig exchange = {};
+};
+
+// Order entry session run as a pipeline of coroutines, decode -> match ->
+// publish and journal, over private books. Stages are connected by bounded
+// StageQueues and take turns on the thread calling Feed and Poll, so a
+// stage whose output queue or sink is full simply stops taking input and
+// the backlog is pushed back, stage by stage, to the caller of Feed instead
+// of growing memory or blocking the thread. StageStats show the depth of
+// every stage's input queue and how long it spent waiting on the next one,
+// i.e. which stage limits throughput.
+//
+// Pre-trade risk runs inside the match stage: its open order and notional
+// counters must include every order before the one being checked, which
+// a separate stage ahead of the books would not see yet. Events are not
+// held back until the journal has written the commands that caused them.
+class SessionPipeline {
+   public:
+    explicit SessionPipeline(PipelineSinks sinks,
+                             const PipelineConfig &config = {});
+
+    // Stages refer to the pipeline by address
+    SessionPipeline(const SessionPipeline &) = delete;
+    SessionPipeline &operator=(const SessionPipeline &) = delete;
+
+    // Register instruments before feeding their orders. Registrations are
+    // journaled directly rather than by the journal stage.
+    std::expected<InstrumentId, std::string> RegisterInstrument(
+        const std::string &instrument, const PriceBand &band)
+    {
+        return m_engine.RegisterInstrument(instrument, band);
+    }
+
+    InstrumentId GetInstrumentId(const std::string &instrument)
+    {
+        return m_engine.GetInstrumentId(instrument);
+    }
+
+    // Check every new order against risk's limits from now on, or stop
+    // checking when null, as Exchange::AttachRisk
+    void AttachRisk(PreTradeRisk *risk) { m_engine.listener().risk = risk; }
+
+    // Journal every accepted command from the journal stage from now on, or
+    // stop when null. The journal must outlive the attachment; commands
+    // already queued go to whichever journal is attached when they leave.
+    // An empty journal first gets the instruments registered so far.
+    void AttachJournal(Journal *journal)
+    {
+        if (journal != nullptr) {
+            RecordInstruments(*journal, m_engine);
+        }
+        m_engine.listener().journal = journal;
+    }
+
+    // Buffer as much of bytes as fits ahead of the decoder and run the
+    // stages until all of them wait. Bytes that do not fit are left for the
+    // caller to feed again, e.g. once Poll has drained the pipeline; a
+    // partial message at the end is kept until the rest of it arrives.
+    // @return bytes taken or descriptive error once the stream is
+    // malformed, in which case the messages before the bad one have been
+    // applied and nothing more is decoded
+    std::expected<std::size_t, std::string> Feed(
+        std::span<const std::byte> bytes);
+
+    // Run the stages again, retrying sinks that were full
+    void Poll() { m_scheduler.run(); }
+
+    // True if every queue is empty and no stage waits on a sink
+    bool idle() const;
+
+    const StageStats &stats(PipelineStage stage) const
+    {
+        return m_stats[static_cast<std::size_t>(stage)];
+    }
+
+   private:
+    struct Listener {
+        PreTradeRisk *risk = nullptr;
+        Journal *journal = nullptr;
+        // What the command being matched produced, handed on after it
+        EventBuffer events{EventBuffer::kDefaultCapacity};
+        std::vector<OrderCommand> commands;
+
+        void OnOrderTraded(InstrumentId instrument, std::uint64_t orderId,
+                           std::int64_t tradedPrice,
+                           std::uint32_t tradedQuantity)
+        {
+            events.recordTrade(instrument, orderId, tradedPrice,
+                               tradedQuantity);
+        }
+
+        void OnBestPriceChanged(InstrumentId instrument, std::int64_t bidPrice,
+                                std::uint32_t bidTotalQuantity,
+                                std::int64_t askPrice,
+                                std::uint32_t askTotalQuantity)
+        {
+            events.recordBestPrice(instrument, bidPrice, bidTotalQuantity,
+                                   askPrice, askTotalQuantity);
+        }
+
+        void OnInstrumentRegistered(InstrumentId instrument,
+                                    const std::string &name,
+                                    const PriceBand *band)
+        {
+            if (journal != nullptr) {
+                journal->recordRegister(instrument, name, band);
+            }
+        }
+
+        void OnOrderAccepted(InstrumentId instrument, Side side,
+                             std::uint64_t orderId, std::int64_t price,
+                             std::uint32_t quantity, TimeInForce timeInForce,
+                             OrderType type, AccountId account);
+
+        void OnOrderCancelled(InstrumentId instrument, Side side,
+                              std::uint64_t orderId);
+
+        void OnOrderModified(InstrumentId instrument, Side side,
+                             std::uint64_t orderId, std::int64_t price,
+                             std::uint32_t quantity);
+
+        std::expected<void, std::string> CheckOrder(
+            const OrderRequest &request) const
+        {
+            if (risk == nullptr) {
+                return {};
+            }
+            return risk->check(request);
+        }
+
+        void OnOrderOpened(AccountId account, std::int64_t price,
+                           std::uint32_t quantity)
+        {
+            if (risk != nullptr) {
+                risk->orderOpened(account, price, quantity);
+            }
+        }
+
+        void OnOrderReduced(AccountId account, std::int64_t price,
+                            std::uint32_t quantity, bool closed)
+        {
+            if (risk != nullptr) {
+                risk->orderReduced(account, price, quantity, closed);
+            }
+        }
+    };
+
+    using Engine = BasicExchange<Listener>;
+
+    struct Reply {
+        std::uint64_t clientTag;
+        std::expected<std::uint64_t, std::string> result;
+    };
+
+    using Output = std::variant<ExchangeEvent, Reply>;
+
+    StageTask decode();
+    StageTask match();
+    StageTask publish();
+    StageTask journal();
+
+    StageStats &statsOf(PipelineStage stage)
+    {
+        return m_stats[static_cast<std::size_t>(stage)];
+    }
+
+    PipelineSinks m_sinks;
+    Engine m_engine;
+    OrderEntryDecoder<Engine> m_decoder;
+
+    std::array<StageStats, kPipelineStages> m_stats{};
+    StageScheduler m_scheduler;
+
+    // Bytes fed and not decoded yet start at m_inputStart
+    std::vector<std::byte> m_input;
+    std::size_t m_inputStart = 0;
+    std::size_t m_inputCapacity;
+    StageSignal m_inputReady;
+    std::string m_error;
+
+    StageQueue<DecodedOrderEntry> m_commands;
+    StageQueue<Output> m_outputs;
+    StageQueue<OrderCommand> m_journalCommands;
+    // Run of events the publish stage hands to its sink at once
+    std::vector<ExchangeEvent> m_batch;
+
+    // Declared last, so the stages are destroyed before what they use
+    std::vector<StageTask> m_stages;
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "HugePages.hpp"
+
+// Fixed-size block arena with an intrusive free list. Blocks are carved out of
+// slabs that are only requested from the heap when the high-water mark grows,
+// so once warmed up an allocate/deallocate cycle never touches malloc.
+class NodeArena {
+   public:
+    static constexpr std::size_t kBlockSize = 64;
+
+    explicit NodeArena(std::size_t capacity) { grow(capacity); }
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    void *allocate()
+    {
+        if (m_free == nullptr) {
+            grow(m_capacity);
+        }
+        Block *block = m_free;
+        m_free = block->next;
+        return block;
+    }
+
+    void deallocate(void *ptr)
+    {
+        Block *block = static_cast<Block *>(ptr);
+        block->next = m_free;
+        m_free = block;
+    }
+
+    std::size_t capacity() const { return m_capacity; }
+
+   private:
+    union Block {
+        Block *next;
+        alignas(std::max_align_t) std::byte storage[kBlockSize];
+    };
+
+    std::vector<std::unique_ptr<Block[]>> m_slabs;
+    Block *m_free = nullptr;
+    std::size_t m_capacity = 0;
+
+    void grow(std::size_t blocks)
+    {
+        if (blocks == 0) {
+            blocks = 1;
+        }
+        auto &slab = m_slabs.emplace_back(std::make_unique<Block[]>(blocks));
+        for (std::size_t i = 0; i < blocks; ++i) {
+            slab[i].next = m_free;
+            m_free = &slab[i];
+        }
+        m_capacity += blocks;
+    }
+};
+
+// Standard allocator serving single node allocations from a NodeArena, for
+// node-based containers such as std::map and std::unordered_map. Array
+// allocations (hash buckets) fall through to the heap, so size those up front
+// with reserve().
+template <typename T>
+class PoolAllocator {
+   public:
+    using value_type = T;
+
+    explicit PoolAllocator(NodeArena &arena) noexcept : m_arena(&arena) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) noexcept
+        : m_arena(other.m_arena)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if (n == 1 && sizeof(T) <= NodeArena::kBlockSize &&
+            alignof(T) <= alignof(std::max_align_t)) {
+            return static_cast<T *>(m_arena->allocate());
+        }
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        if (n == 1 && sizeof(T) <= NodeArena::kBlockSize &&
+            alignof(T) <= alignof(std::max_align_t)) {
+            m_arena->deallocate(ptr);
+            return;
+        }
+        std::allocator<T>{}.deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &other) const noexcept
+    {
+        return m_arena == other.m_arena;
+    }
+
+   private:
+    template <typename U>
+    friend class PoolAllocator;
+
+    NodeArena *m_arena;
+};
+
+// Slab of T addressed by dense 32-bit handles, with released handles reused
+// before the slab grows. Handles stay valid across growth, references do not.
+template <typename T>
+class Pool {
+   public:
+    using Handle = std::uint32_t;
+    static constexpr Handle kNull = std::numeric_limits<Handle>::max();
+
+    explicit Pool(std::size_t capacity)
+    {
+        m_items.reserve(capacity);
+        m_freeList.reserve(capacity);
+    }
+
+    Handle allocate(const T &item)
+    {
+        if (!m_freeList.empty()) {
+            Handle handle = m_freeList.back();
+            m_freeList.pop_back();
+            m_items[handle] = item;
+            return handle;
+        }
+        m_items.push_back(item);
+        return static_cast<Handle>(m_items.size() - 1);
+    }
+
+    void release(Handle handle) { m_freeList.push_back(handle); }
+
+    T &operator[](Handle handle) { return m_items[handle]; }
+    const T &operator[](Handle handle) const { return m_items[handle]; }
+
+    std::size_t size() const { return m_items.size() - m_freeList.size(); }
+
+    // Fault in the storage reserved at construction from the calling thread,
+    // which places it on that thread's NUMA node, so that allocating up to
+    // that capacity never page faults. With hugePages it asks for huge pages
+    // first.
+    void prewarm(bool hugePages)
+    {
+        prefaultReserved(m_items, hugePages);
+        prefaultReserved(m_freeList, hugePages);
+    }
+
+   private:
+    std::vector<T> m_items;
+    std::vector<Handle> m_freeList;
+};
+
+// Pool of items split into a hot part and a cold part, kept in two arrays
+// under the same handle, so that walks reading only the hot parts stream
+// through less memory
+template <typename Hot, typename Cold>
+class SplitPool {
+   public:
+    using Handle = typename Pool<Hot>::Handle;
+    static constexpr Handle kNull = Pool<Hot>::kNull;
+
+    explicit SplitPool(std::size_t capacity) : m_hot(capacity)
+    {
+        m_cold.reserve(capacity);
+    }
+
+    Handle allocate(const Hot &hot, const Cold &cold)
+    {
+        Handle handle = m_hot.allocate(hot);
+        if (handle == m_cold.size()) {
+            m_cold.push_back(cold);
+        }
+        else {
+            m_cold[handle] = cold;
+        }
+        return handle;
+    }
+
+    void release(Handle handle) { m_hot.release(handle); }
+
+    Hot &operator[](Handle handle) { return m_hot[handle]; }
+    const Hot &operator[](Handle handle) const { return m_hot[handle]; }
+
+    Cold &cold(Handle handle) { return m_cold[handle]; }
+    const Cold &cold(Handle handle) const { return m_cold[handle]; }
+
+    std::size_t size() const { return m_hot.size(); }
+
+    // See Pool::prewarm
+    void prewarm(bool hugePages)
+    {
+        m_hot.prewarm(hugePages);
+        prefaultReserved(m_cold, hugePages);
+    }
+
+   private:
+    Pool<Hot> m_hot;
+    std::vector<Cold> m_cold;
+};
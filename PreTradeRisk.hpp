@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+
+// Pre-trade limits of one account, each unlimited by default
+struct RiskLimits {
+    std::uint32_t maxOrderQuantity = std::numeric_limits<std::uint32_t>::max();
+    // Open orders of the account, counting an order that may rest
+    std::uint32_t maxOpenOrders = std::numeric_limits<std::uint32_t>::max();
+    // Price times quantity summed over the account's resting orders and the
+    // incoming one, as if it rested in full. Market orders are valued at the
+    // opposite best price.
+    std::uint64_t maxOpenNotional = std::numeric_limits<std::uint64_t>::max();
+    // Limit prices further than this from the reference price are rejected,
+    // in basis points of it, 0 for no band. The reference is the opposite
+    // best price, or the same side's when the opposite side is empty.
+    std::uint32_t priceBandBps = 0;
+};
+
+// Per-account pre-trade risk checks for a listener implementing
+// RiskListener. Each account's limits sit next to its open order and
+// notional counters, which the engine updates as orders rest, trade and are
+// cancelled, so a check reads one cache line and never walks a book.
+// Accounts are fixed up front; orders of accounts past the capacity are
+// rejected.
+class PreTradeRisk {
+   public:
+    static constexpr std::size_t kDefaultAccounts = 256;
+
+    explicit PreTradeRisk(std::size_t accounts = kDefaultAccounts)
+        : m_accounts(accounts)
+    {
+    }
+
+    PreTradeRisk(const PreTradeRisk &) = delete;
+    PreTradeRisk &operator=(const PreTradeRisk &) = delete;
+
+    std::size_t accountCapacity() const { return m_accounts.size(); }
+
+    // Replace an account's limits; orders already resting are kept
+    // @return success or descriptive error
+    std::expected<void, std::string> setLimits(AccountId account,
+                                               const RiskLimits &limits)
+    {
+        if (account >= m_accounts.size()) {
+            return std::unexpected("Unknown account");
+        }
+        m_accounts[account].limits = limits;
+        return {};
+    }
+
+    // @pre account < accountCapacity()
+    std::uint32_t openOrders(AccountId account) const
+    {
+        return m_accounts[account].openOrders;
+    }
+
+    // @pre account < accountCapacity()
+    std::uint64_t openNotional(AccountId account) const
+    {
+        return m_accounts[account].openNotional;
+    }
+
+    // @return success or descriptive error naming the limit breached
+    std::expected<void, std::string> check(const OrderRequest &request) const
+    {
+        if (request.account >= m_accounts.size()) {
+            return std::unexpected("Unknown account");
+        }
+        const AccountState &state = m_accounts[request.account];
+        const RiskLimits &limits = state.limits;
+        if (request.quantity > limits.maxOrderQuantity) {
+            return std::unexpected("Order quantity exceeds account limit");
+        }
+        bool buy = request.side == Side::BUY;
+        std::int64_t opposite = buy ? request.askPrice : request.bidPrice;
+        std::int64_t reference =
+            opposite != 0 ? opposite : (buy ? request.bidPrice
+                                            : request.askPrice);
+        if (request.type == OrderType::LIMIT && limits.priceBandBps != 0 &&
+            reference != 0 &&
+            outsideBand(request.price, reference, limits.priceBandBps)) {
+            return std::unexpected("Price outside account's price band");
+        }
+        // An amend keeps its order's open slot
+        bool mayRest = request.timeInForce == TimeInForce::GTC &&
+                       request.type == OrderType::LIMIT &&
+                       request.replacedQuantity == 0;
+        if (mayRest && state.openOrders >= limits.maxOpenOrders) {
+            return std::unexpected("Open orders exceed account limit");
+        }
+        std::int64_t price =
+            request.type == OrderType::MARKET ? opposite : request.price;
+        std::uint64_t open =
+            state.openNotional -
+            notional(request.replacedPrice, request.replacedQuantity);
+        std::uint64_t added = static_cast<std::uint64_t>(price);
+        if ((added != 0 && request.quantity > kNotionalMax / added) ||
+            open > limits.maxOpenNotional ||
+            added * request.quantity > limits.maxOpenNotional - open) {
+            return std::unexpected("Open notional exceeds account limit");
+        }
+        return {};
+    }
+
+    void orderOpened(AccountId account, std::int64_t price,
+                     std::uint32_t quantity)
+    {
+        if (account < m_accounts.size()) {
+            AccountState &state = m_accounts[account];
+            ++state.openOrders;
+            state.openNotional += notional(price, quantity);
+        }
+    }
+
+    void orderReduced(AccountId account, std::int64_t price,
+                      std::uint32_t quantity, bool closed)
+    {
+        if (account < m_accounts.size()) {
+            AccountState &state = m_accounts[account];
+            state.openOrders -= closed ? 1 : 0;
+            state.openNotional -= notional(price, quantity);
+        }
+    }
+
+   private:
+    static constexpr std::uint64_t kNotionalMax =
+        std::numeric_limits<std::uint64_t>::max();
+
+    // One cache line per account, so checks on different accounts never
+    // share one
+    struct alignas(64) AccountState {
+        RiskLimits limits;
+        std::uint32_t openOrders = 0;
+        // Modulo 2^64, which keeps it exact while the true total fits as the
+        // same products are added and taken away
+        std::uint64_t openNotional = 0;
+    };
+
+    std::vector<AccountState> m_accounts;
+
+    static std::uint64_t notional(std::int64_t price, std::uint32_t quantity)
+    {
+        return static_cast<std::uint64_t>(price) * quantity;
+    }
+
+    // Whether price is more than bps basis points away from reference,
+    // without overflowing on large prices
+    static bool outsideBand(std::int64_t price, std::int64_t reference,
+                            std::uint32_t bps)
+    {
+        auto base = static_cast<std::uint64_t>(reference);
+        std::uint64_t distance =
+            price > reference ? static_cast<std::uint64_t>(price) - base
+                              : base - static_cast<std::uint64_t>(price);
+        std::uint64_t band = base / 10000 * bps + base % 10000 * bps / 10000;
+        return distance > band;
+    }
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "Pool.hpp"
+
+// Tick size and price band of an instrument booked on a price ladder, in
+// the same signed units as order prices
+struct PriceBand {
+    std::int64_t minPrice;
+    std::int64_t maxPrice;
+    std::int64_t tickSize;
+};
+
+// One side of a book, ordered so that best() is the first level to match.
+// Both implementations hand out stable Level references: a Level stays at the
+// same address until it is erased. Level must expose `price` and `empty()`.
+// forEach visits the levels best first, forEachWhile stops once its function
+// returns false.
+//
+// MapLevels keeps levels in a tree and accepts any price, for instruments
+// without a known price band.
+template <typename Level, typename Compare>
+class MapLevels {
+   public:
+    using PriceT = decltype(Level::price);
+
+    explicit MapLevels(std::size_t capacity)
+        : m_arena(std::make_unique<NodeArena>(capacity)),
+          m_levels(typename LevelMapT::allocator_type{*m_arena})
+    {
+    }
+
+    bool accepts(PriceT) const { return true; }
+
+    Level *best()
+    {
+        return m_levels.empty() ? nullptr : &m_levels.begin()->second;
+    }
+
+    const Level *best() const
+    {
+        return m_levels.empty() ? nullptr : &m_levels.begin()->second;
+    }
+
+    Level &findOrCreate(PriceT price)
+    {
+        auto [iter, inserted] = m_levels.try_emplace(price);
+        if (inserted) {
+            iter->second.price = price;
+        }
+        return iter->second;
+    }
+
+    void erase(Level &level) { m_levels.erase(level.price); }
+
+    template <typename Func>
+    void forEach(Func &&func) const
+    {
+        for (const auto &[price, level] : m_levels) {
+            func(level);
+        }
+    }
+
+    template <typename Func>
+    void forEachWhile(Func &&func) const
+    {
+        for (const auto &[price, level] : m_levels) {
+            if (!func(level)) {
+                return;
+            }
+        }
+    }
+
+   private:
+    using LevelMapT =
+        std::map<PriceT, Level, Compare,
+                 PoolAllocator<std::pair<const PriceT, Level>>>;
+
+    // Heap-owned so the map's allocator stays valid when this is moved
+    std::unique_ptr<NodeArena> m_arena;
+    LevelMapT m_levels;
+};
+
+// LadderLevels keeps one preallocated level per tick of a PriceBand, indexed
+// by (price - minPrice) / tickSize. A bitmap of non-empty levels and a cached
+// best index make best() a load and finding the next level a word scan.
+template <typename Level, typename Compare>
+class LadderLevels {
+   public:
+    using PriceT = decltype(Level::price);
+
+    explicit LadderLevels(const PriceBand &band)
+        : m_band(band),
+          m_levels((band.maxPrice - band.minPrice) / band.tickSize + 1),
+          m_occupied((m_levels.size() + kWordBits - 1) / kWordBits)
+    {
+        for (std::size_t i = 0; i < m_levels.size(); ++i) {
+            m_levels[i].price =
+                band.minPrice + static_cast<PriceT>(i) * band.tickSize;
+        }
+    }
+
+    const PriceBand &band() const { return m_band; }
+
+    bool accepts(PriceT price) const
+    {
+        return price >= m_band.minPrice && price <= m_band.maxPrice &&
+               (price - m_band.minPrice) % m_band.tickSize == 0;
+    }
+
+    Level *best() { return m_best == kNone ? nullptr : &m_levels[m_best]; }
+
+    const Level *best() const
+    {
+        return m_best == kNone ? nullptr : &m_levels[m_best];
+    }
+
+    // @pre accepts(price)
+    Level &findOrCreate(PriceT price)
+    {
+        std::size_t index = (price - m_band.minPrice) / m_band.tickSize;
+        m_occupied[index / kWordBits] |= std::uint64_t{1}
+                                         << (index % kWordBits);
+        if (m_best == kNone ||
+            (kDescending ? index > m_best : index < m_best)) {
+            m_best = index;
+        }
+        return m_levels[index];
+    }
+
+    void erase(Level &level)
+    {
+        std::size_t index = static_cast<std::size_t>(&level - m_levels.data());
+        m_occupied[index / kWordBits] &=
+            ~(std::uint64_t{1} << (index % kWordBits));
+        if (index == m_best) {
+            m_best = kDescending ? findBelow(index) : findAbove(index);
+        }
+    }
+
+    template <typename Func>
+    void forEach(Func &&func) const
+    {
+        forEachWhile([&func](const Level &level) {
+            func(level);
+            return true;
+        });
+    }
+
+    template <typename Func>
+    void forEachWhile(Func &&func) const
+    {
+        std::size_t index = m_best;
+        while (index != kNone && func(m_levels[index])) {
+            index = kDescending ? (index == 0 ? kNone : findBelow(index - 1))
+                                : findAbove(index + 1);
+        }
+    }
+
+   private:
+    static constexpr std::size_t kWordBits = 64;
+    static constexpr std::size_t kNone = static_cast<std::size_t>(-1);
+    static constexpr bool kDescending = Compare{}(1, 0);
+
+    PriceBand m_band;
+    std::vector<Level> m_levels;
+    std::vector<std::uint64_t> m_occupied;
+    std::size_t m_best = kNone;
+
+    // Lowest occupied index >= from
+    std::size_t findAbove(std::size_t from) const
+    {
+        std::size_t word = from / kWordBits;
+        if (word >= m_occupied.size()) {
+            return kNone;
+        }
+        std::uint64_t bits = m_occupied[word] & (~std::uint64_t{0}
+                                                 << (from % kWordBits));
+        while (bits == 0) {
+            if (++word == m_occupied.size()) {
+                return kNone;
+            }
+            bits = m_occupied[word];
+        }
+        return word * kWordBits + std::countr_zero(bits);
+    }
+
+    // Highest occupied index <= from
+    std::size_t findBelow(std::size_t from) const
+    {
+        std::size_t word = from / kWordBits;
+        std::uint64_t bits =
+            m_occupied[word] &
+            (~std::uint64_t{0} >> (kWordBits - 1 - from % kWordBits));
+        while (bits == 0) {
+            if (word-- == 0) {
+                return kNone;
+            }
+            bits = m_occupied[word];
+        }
+        return word * kWordBits + (kWordBits - 1 - std::countl_zero(bits));
+    }
+};
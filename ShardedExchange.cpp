@@ -0,0 +1,288 @@
+#include "ShardedExchange.hpp"
+
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ShardedExchange::ShardedExchange(std::size_t shards, std::vector<int> cpus,
+                                 std::size_t queueCapacity)
+{
+    if (shards == 0) {
+        shards = 1;
+    }
+    m_shards.reserve(shards);
+    for (std::size_t i = 0; i < shards; ++i) {
+        Shard &shard = *m_shards.emplace_back(
+            std::make_unique<Shard>(*this, queueCapacity));
+        shard.worker = std::thread([this, &shard] { runShard(shard); });
+#ifdef __linux__
+        if (i < cpus.size()) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpus[i], &cpuset);
+            pthread_setaffinity_np(shard.worker.native_handle(),
+                                   sizeof(cpuset), &cpuset);
+        }
+#endif
+    }
+}
+
+ShardedExchange::~ShardedExchange()
+{
+    m_stopping.store(true, std::memory_order_release);
+    for (auto &shard : m_shards) {
+        shard->worker.join();
+    }
+}
+
+void ShardedExchange::ShardListener::OnOrderTraded(
+    InstrumentId instrument, std::uint64_t orderId, std::int64_t tradedPrice,
+    std::uint32_t tradedQuantity)
+{
+    shard->pending.push_back(Event{Event::Type::ORDER_TRADED,
+                                   shard->names[instrument], orderId,
+                                   tradedPrice, tradedQuantity, 0, 0});
+}
+
+void ShardedExchange::ShardListener::OnBestPriceChanged(
+    InstrumentId instrument, std::int64_t bidPrice,
+    std::uint32_t bidTotalQuantity, std::int64_t askPrice,
+    std::uint32_t askTotalQuantity)
+{
+    shard->pending.push_back(Event{Event::Type::BEST_PRICE_CHANGED,
+                                   shard->names[instrument], 0, bidPrice,
+                                   bidTotalQuantity, askPrice,
+                                   askTotalQuantity});
+}
+
+void ShardedExchange::ShardListener::OnCommandComplete()
+{
+    owner->publish(*shard, shard->pending);
+    shard->pending.clear();
+}
+
+InstrumentId ShardedExchange::GetInstrumentId(const std::string &instrument)
+{
+    auto [iter, inserted] = m_instrumentIds.try_emplace(
+        instrument, static_cast<InstrumentId>(m_routes.size()));
+    if (inserted) {
+        auto shard_index =
+            static_cast<std::uint32_t>(iter->second % m_shards.size());
+        Shard &shard = *m_shards[shard_index];
+        // Shards register instruments in the order they are routed, so the
+        // shard-local id is known without a round trip
+        m_routes.push_back(Route{shard_index, shard.instrumentCount++});
+        submit(shard, Command{Command::Type::REGISTER, Side::BUY, 0, 0, 0, 0,
+                              TimeInForce::GTC, OrderType::LIMIT,
+                              &iter->first});
+    }
+    return iter->second;
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::AddOrder(
+    const std::string &instrument, Side side, std::int64_t price,
+    std::uint32_t quantity)
+{
+    return AddOrder(GetInstrumentId(instrument), side, price, quantity);
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity)
+{
+    return AddOrder(instrument, side, price, quantity, TimeInForce::GTC,
+                    OrderType::LIMIT);
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::AddOrder(
+    InstrumentId instrument, Side side, std::int64_t price,
+    std::uint32_t quantity, TimeInForce timeInForce, OrderType type)
+{
+    if (instrument >= m_routes.size()) {
+        return std::unexpected("Unknown instrument");
+    }
+    auto valid = BasicExchange<ShardListener>::validateOrder(
+        price, quantity, timeInForce, type);
+    if (!valid) {
+        return std::unexpected(std::move(valid.error()));
+    }
+    const Route &route = m_routes[instrument];
+    // A rejected order does not use up an id
+    if (!trySubmit(*m_shards[route.shard],
+                   Command{Command::Type::ADD, side, route.local,
+                           m_orderCount, price, quantity, timeInForce, type,
+                           nullptr})) {
+        return std::unexpected("Shard queue full");
+    }
+    return m_orderCount++;
+}
+
+bool ShardedExchange::RemoveOrder(const std::string &instrument, Side side,
+                                  std::uint64_t orderId)
+{
+    auto iter = m_instrumentIds.find(instrument);
+    if (iter == m_instrumentIds.end()) {
+        return false;
+    }
+    return RemoveOrder(iter->second, side, orderId);
+}
+
+bool ShardedExchange::RemoveOrder(InstrumentId instrument, Side side,
+                                  std::uint64_t orderId)
+{
+    if (instrument >= m_routes.size()) {
+        return false;
+    }
+    const Route &route = m_routes[instrument];
+    return trySubmit(*m_shards[route.shard],
+                     Command{Command::Type::REMOVE, side, route.local,
+                             orderId, 0, 0, TimeInForce::GTC,
+                             OrderType::LIMIT, nullptr});
+}
+
+bool ShardedExchange::RemoveOrder(std::uint64_t orderId)
+{
+    broadcast(Command{Command::Type::REMOVE_ANY, Side::BUY, 0, orderId, 0, 0,
+                      TimeInForce::GTC, OrderType::LIMIT, nullptr});
+    return true;
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::ModifyOrder(
+    std::uint64_t orderId, std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    broadcast(Command{Command::Type::MODIFY_ANY, Side::BUY, 0, orderId,
+                      newPrice, newQuantity, TimeInForce::GTC,
+                      OrderType::LIMIT, nullptr});
+    return orderId;
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::ModifyOrder(
+    const std::string &instrument, Side side, std::uint64_t orderId,
+    std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    auto iter = m_instrumentIds.find(instrument);
+    if (iter == m_instrumentIds.end()) {
+        return std::unexpected("Unknown instrument");
+    }
+    return ModifyOrder(iter->second, side, orderId, newPrice, newQuantity);
+}
+
+std::expected<std::uint64_t, std::string> ShardedExchange::ModifyOrder(
+    InstrumentId instrument, Side side, std::uint64_t orderId,
+    std::int64_t newPrice, std::uint32_t newQuantity)
+{
+    if (instrument >= m_routes.size()) {
+        return std::unexpected("Unknown instrument");
+    }
+    const Route &route = m_routes[instrument];
+    if (!trySubmit(*m_shards[route.shard],
+                   Command{Command::Type::MODIFY, side, route.local, orderId,
+                           newPrice, newQuantity, TimeInForce::GTC,
+                           OrderType::LIMIT, nullptr})) {
+        return std::unexpected("Shard queue full");
+    }
+    return orderId;
+}
+
+std::size_t ShardedExchange::PollEvents()
+{
+    auto deliver = [this](const Event &event) {
+        if (event.type == Event::Type::ORDER_TRADED) {
+            if (OrderTraded) {
+                OrderTraded(*event.instrument, event.orderId, event.price,
+                            event.quantity);
+            }
+        }
+        else if (BestPriceChanged) {
+            BestPriceChanged(*event.instrument, event.price, event.quantity,
+                             event.askPrice, event.askQuantity);
+        }
+    };
+    std::size_t delivered = 0;
+    for (auto &shard : m_shards) {
+        while (std::size_t count = shard->events.popBatch(deliver)) {
+            delivered += count;
+        }
+    }
+    return delivered;
+}
+
+bool ShardedExchange::trySubmit(Shard &shard, const Command &command)
+{
+    return shard.commands.tryPush(command);
+}
+
+void ShardedExchange::submit(Shard &shard, const Command &command)
+{
+    // Back-pressure: wait for the shard to catch up rather than drop
+    while (!shard.commands.tryPush(command)) {
+        cpuRelax();
+    }
+}
+
+void ShardedExchange::broadcast(const Command &command)
+{
+    for (auto &shard : m_shards) {
+        submit(*shard, command);
+    }
+}
+
+void ShardedExchange::publish(Shard &shard, std::span<const Event> events)
+{
+    // A command's events are pushed together unless the ring is too full
+    while (!events.empty()) {
+        events = events.subspan(shard.events.tryPushBatch(events));
+        // Nobody is left to poll once the front end is shutting down
+        if (events.empty() || m_stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        cpuRelax();
+    }
+}
+
+void ShardedExchange::runShard(Shard &shard)
+{
+    auto apply = [&shard](const Command &command) {
+        switch (command.type) {
+            case Command::Type::REGISTER:
+                shard.exchange.GetInstrumentId(*command.name);
+                shard.names.push_back(command.name);
+                break;
+            case Command::Type::ADD:
+                shard.exchange.AddOrderWithId(command.instrument, command.side,
+                                              command.orderId, command.price,
+                                              command.quantity,
+                                              command.timeInForce,
+                                              command.orderType);
+                break;
+            case Command::Type::REMOVE:
+                shard.exchange.RemoveOrder(command.instrument, command.side,
+                                           command.orderId);
+                break;
+            case Command::Type::MODIFY:
+                shard.exchange.ModifyOrder(command.instrument, command.side,
+                                           command.orderId, command.price,
+                                           command.quantity);
+                break;
+            case Command::Type::REMOVE_ANY:
+                shard.exchange.RemoveOrder(command.orderId);
+                break;
+            case Command::Type::MODIFY_ANY:
+                shard.exchange.ModifyOrder(command.orderId, command.price,
+                                           command.quantity);
+                break;
+        }
+    };
+    while (true) {
+        if (shard.commands.popBatch(apply, kCommandBatch) == 0) {
+            if (m_stopping.load(std::memory_order_acquire) &&
+                shard.commands.empty()) {
+                return;
+            }
+            cpuRelax();
+        }
+    }
+}
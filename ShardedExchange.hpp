@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+#include "SpscRing.hpp"
+
+// Front end that partitions instruments across worker threads, each owning a
+// private BasicExchange. Books of different instruments never interact, so
+// shards match independently while every instrument's commands stay in order.
+//
+// Threading: AddOrder, RemoveOrder and GetInstrumentId must be called from a
+// single gateway thread, and PollEvents from a single (possibly different)
+// thread; the callbacks run on the thread calling PollEvents.
+//
+// Commands are applied asynchronously. AddOrder checks what it can without
+// the book, its quantity, price and type, and returns the id the order will
+// rest under; RemoveOrder and ModifyOrder only report whether the command
+// could be routed. A command for a shard whose queue is full fails at once
+// rather than waiting for the shard. Amending or cancelling an order that
+// already traded is silently ignored by its shard, as is a fill-or-kill
+// order that cannot fill or a price the book rejects. The front end does not
+// track which shard an order id lives on, so the overloads taking only an id
+// go to every shard; prefer the InstrumentId overloads on the hot path.
+//
+// GetInstrumentId and the overloads taking only an id must not be lost, so
+// they wait for room in the shards' queues instead. A shard whose event ring
+// is full waits for PollEvents, so a thread that both submits and polls can
+// deadlock on them; poll from another thread, or often enough that the
+// event rings never fill.
+class ShardedExchange : public IExchange {
+   public:
+    static constexpr std::size_t kDefaultQueueCapacity = 1 << 16;
+
+    // Start one worker per shard, worker i is pinned to cpus[i] if given
+    explicit ShardedExchange(std::size_t shards, std::vector<int> cpus = {},
+                             std::size_t queueCapacity = kDefaultQueueCapacity);
+
+    // Workers finish the commands already submitted before exiting. Events
+    // not yet polled are dropped.
+    ~ShardedExchange() override;
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        const std::string &instrument, Side side, std::int64_t price,
+        std::uint32_t quantity) override;
+
+    bool RemoveOrder(const std::string &instrument, Side side,
+                     std::uint64_t orderId) override;
+
+    InstrumentId GetInstrumentId(const std::string &instrument) override;
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity) override;
+
+    std::expected<std::uint64_t, std::string> AddOrder(
+        InstrumentId instrument, Side side, std::int64_t price,
+        std::uint32_t quantity, TimeInForce timeInForce,
+        OrderType type) override;
+
+    bool RemoveOrder(InstrumentId instrument, Side side,
+                     std::uint64_t orderId) override;
+
+    bool RemoveOrder(std::uint64_t orderId) override;
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        const std::string &instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) override;
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        InstrumentId instrument, Side side, std::uint64_t orderId,
+        std::int64_t newPrice, std::uint32_t newQuantity) override;
+
+    std::expected<std::uint64_t, std::string> ModifyOrder(
+        std::uint64_t orderId, std::int64_t newPrice,
+        std::uint32_t newQuantity) override;
+
+    // Deliver the events produced by the shards so far through OrderTraded
+    // and BestPriceChanged
+    // @return number of events delivered
+    std::size_t PollEvents();
+
+    std::size_t shardCount() const { return m_shards.size(); }
+
+   private:
+    // Commands a worker applies between releases of its ingress ring
+    static constexpr std::size_t kCommandBatch = 64;
+
+    // Initial room for the events of one command
+    static constexpr std::size_t kPendingCapacity = 1024;
+
+    struct Command {
+        enum class Type : std::uint8_t {
+            REGISTER,
+            ADD,
+            REMOVE,
+            MODIFY,
+            // By order id alone, sent to every shard
+            REMOVE_ANY,
+            MODIFY_ANY
+        };
+
+        Type type;
+        Side side;
+        InstrumentId instrument;  // shard-local
+        std::uint64_t orderId;
+        std::int64_t price;
+        std::uint32_t quantity;
+        TimeInForce timeInForce;  // ADD only
+        OrderType orderType;      // ADD only
+        const std::string *name;  // REGISTER only
+    };
+
+    struct Event {
+        enum class Type : std::uint8_t { ORDER_TRADED, BEST_PRICE_CHANGED };
+
+        Type type;
+        // Key in the front end's m_instrumentIds
+        const std::string *instrument;
+        std::uint64_t orderId;
+        // Traded price and quantity, or the bid side of a BBO update
+        std::int64_t price;
+        std::uint32_t quantity;
+        std::int64_t askPrice;
+        std::uint32_t askQuantity;
+    };
+
+    struct Shard;
+
+    // Turns a shard's matching events into Events, collected in
+    // Shard::pending during a command and published to its output ring in
+    // one push once the command is applied
+    struct ShardListener {
+        ShardedExchange *owner;
+        Shard *shard;
+
+        void OnOrderTraded(InstrumentId instrument, std::uint64_t orderId,
+                           std::int64_t tradedPrice,
+                           std::uint32_t tradedQuantity);
+
+        void OnBestPriceChanged(InstrumentId instrument, std::int64_t bidPrice,
+                                std::uint32_t bidTotalQuantity,
+                                std::int64_t askPrice,
+                                std::uint32_t askTotalQuantity);
+
+        void OnCommandComplete();
+    };
+
+    struct Shard {
+        Shard(ShardedExchange &owner, std::size_t queueCapacity)
+            : commands(queueCapacity),
+              events(queueCapacity),
+              exchange(ShardListener{&owner, this})
+        {
+            pending.reserve(kPendingCapacity);
+        }
+
+        SpscRing<Command> commands;
+        SpscRing<Event> events;
+        BasicExchange<ShardListener> exchange;
+        std::thread worker;
+
+        // Front end names indexed by shard-local InstrumentId, only touched
+        // by the worker
+        std::vector<const std::string *> names;
+
+        // Events of the command being applied, only touched by the worker
+        std::vector<Event> pending;
+
+        // Instruments routed here so far, the next shard-local id
+        InstrumentId instrumentCount = 0;
+    };
+
+    struct Route {
+        std::uint32_t shard;
+        InstrumentId local;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<bool> m_stopping{false};
+
+    std::unordered_map<std::string /* instrument */, InstrumentId>
+        m_instrumentIds;
+
+    // Indexed by the front end's InstrumentId
+    std::vector<Route> m_routes;
+
+    // For generating unique order IDs across all shards
+    std::uint64_t m_orderCount = 0;
+
+    // @return false if the shard's queue is full
+    bool trySubmit(Shard &shard, const Command &command);
+    // Wait for room in the shard's queue
+    void submit(Shard &shard, const Command &command);
+    void broadcast(const Command &command);
+    void publish(Shard &shard, std::span<const Event> events);
+    void runShard(Shard &shard);
+};
@@ -0,0 +1,182 @@
+#include "Snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+SnapshotSink::SnapshotSink(const char *path, const char *tempPath)
+    : m_path(path),
+      m_tempPath(tempPath),
+      m_fd(::open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+{
+}
+
+SnapshotSink::~SnapshotSink()
+{
+    // Never committed, leave any previous snapshot in place
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        ::unlink(m_tempPath);
+    }
+}
+
+bool SnapshotSink::write(const void *data, std::size_t size)
+{
+    if (m_fd < 0) {
+        return false;
+    }
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        if (m_used == kBufferSize && !drain()) {
+            return false;
+        }
+        std::size_t count = std::min(size, kBufferSize - m_used);
+        std::memcpy(m_buffer + m_used, bytes, count);
+        m_used += count;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool SnapshotSink::drain()
+{
+    std::size_t offset = 0;
+    while (offset < m_used) {
+        ssize_t written = ::write(m_fd, m_buffer + offset, m_used - offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        offset += static_cast<std::size_t>(written);
+    }
+    m_used = 0;
+    return true;
+}
+
+bool SnapshotSink::commit()
+{
+    if (m_fd < 0 || !drain() || ::fsync(m_fd) != 0) {
+        return false;
+    }
+    int fd = std::exchange(m_fd, -1);
+    if (::close(fd) != 0 || std::rename(m_tempPath, m_path) != 0) {
+        ::unlink(m_tempPath);
+        return false;
+    }
+    return true;
+}
+
+std::expected<MappedSnapshot, std::string> MappedSnapshot::Open(
+    const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::unexpected("Cannot open snapshot " + path + ": " +
+                               std::strerror(errno));
+    }
+    struct stat status {};
+    if (::fstat(fd, &status) != 0 ||
+        static_cast<std::size_t>(status.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return std::unexpected("Invalid snapshot " + path);
+    }
+    auto size = static_cast<std::size_t>(status.st_size);
+    void *data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return std::unexpected("Cannot map snapshot " + path + ": " +
+                               std::strerror(errno));
+    }
+    ::madvise(data, size, MADV_SEQUENTIAL);
+    MappedSnapshot snapshot(data, size);
+
+    // Every count and offset must stay inside the mapping before anything
+    // reads through it
+    const SnapshotHeader &header = snapshot.header();
+    bool valid = std::equal(std::begin(header.magic), std::end(header.magic),
+                            std::begin(SnapshotHeader::kMagic));
+    std::size_t tables = sizeof(SnapshotHeader);
+    valid = valid &&
+            header.instrumentCount <=
+                (size - tables) / sizeof(SnapshotInstrument);
+    tables += valid ? header.instrumentCount * sizeof(SnapshotInstrument) : 0;
+    valid = valid &&
+            header.orderCount <= (size - tables) / sizeof(SnapshotOrder);
+    std::uint64_t orders = 0;
+    if (valid) {
+        for (const SnapshotInstrument &entry : snapshot.instruments()) {
+            orders += entry.bidCount + entry.askCount;
+            valid = valid && entry.nameOffset <= size &&
+                    entry.nameLength <= size - entry.nameOffset &&
+                    entry.bidCount <= header.orderCount &&
+                    entry.askCount <= header.orderCount;
+        }
+    }
+    if (!valid || orders != header.orderCount) {
+        return std::unexpected("Invalid snapshot " + path);
+    }
+    return snapshot;
+}
+
+MappedSnapshot::MappedSnapshot(MappedSnapshot &&other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0))
+{
+}
+
+MappedSnapshot::~MappedSnapshot()
+{
+    if (m_data != nullptr) {
+        ::munmap(const_cast<void *>(m_data), m_size);
+    }
+}
+
+std::span<const SnapshotInstrument> MappedSnapshot::instruments() const
+{
+    const char *base = static_cast<const char *>(m_data);
+    return {reinterpret_cast<const SnapshotInstrument *>(
+                base + sizeof(SnapshotHeader)),
+            header().instrumentCount};
+}
+
+std::span<const SnapshotOrder> MappedSnapshot::orders() const
+{
+    const char *base = static_cast<const char *>(m_data);
+    std::size_t offset = sizeof(SnapshotHeader) +
+                         header().instrumentCount * sizeof(SnapshotInstrument);
+    return {reinterpret_cast<const SnapshotOrder *>(base + offset),
+            header().orderCount};
+}
+
+std::expected<void, std::string> SnapshotJob::wait()
+{
+    int status = 0;
+    while (::waitpid(m_pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return std::unexpected(std::string("Cannot wait for snapshot: ") +
+                                   std::strerror(errno));
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::unexpected("Snapshot writer failed");
+    }
+    return {};
+}
+
+namespace detail {
+
+pid_t forkSnapshotChild() { return ::fork(); }
+
+void exitSnapshotChild(bool success) { ::_exit(success ? 0 : 1); }
+
+}  // namespace detail
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "BasicExchange.hpp"
+#include "IExchange.hpp"
+#include "PriceLevels.hpp"
+
+// Flat snapshot file of every book of an exchange:
+//
+//   SnapshotHeader
+//   SnapshotInstrument[instrumentCount]   in InstrumentId order
+//   SnapshotOrder[orderCount]             per instrument its bids then asks,
+//                                         best price first, in time priority
+//   name bytes
+//
+// All structures are read in place from a read-only mapping of the file.
+struct SnapshotHeader {
+    static constexpr char kMagic[8] = {'E', 'X', 'S', 'N', 'A', 'P', '0', '2'};
+
+    char magic[8];
+    // Journal sequence the snapshot covers, see Journal::sequence
+    std::uint64_t journalSequence;
+    std::uint64_t nextOrderId;
+    std::uint64_t instrumentCount;
+    std::uint64_t orderCount;
+};
+
+struct SnapshotInstrument {
+    PriceBand band;  // tick size 0 for a tree of levels
+    // Offset from the start of the file
+    std::uint64_t nameOffset;
+    std::uint64_t nameLength;
+    std::uint64_t bidCount;
+    std::uint64_t askCount;
+};
+
+struct SnapshotOrder {
+    std::uint64_t orderId;
+    std::int64_t price;
+    std::uint32_t quantity;
+    // Zero in files written before orders carried an account
+    AccountId account;
+    std::uint16_t reserved;
+};
+
+// Buffered writer of a snapshot file that never allocates, so it can run in
+// a child forked from a multi-threaded process. The file only replaces path
+// once commit() succeeds.
+class SnapshotSink {
+   public:
+    // Both paths must outlive the sink
+    SnapshotSink(const char *path, const char *tempPath);
+    ~SnapshotSink();
+
+    SnapshotSink(const SnapshotSink &) = delete;
+    SnapshotSink &operator=(const SnapshotSink &) = delete;
+
+    bool write(const void *data, std::size_t size);
+
+    // Flush, sync and atomically rename over path
+    bool commit();
+
+   private:
+    static constexpr std::size_t kBufferSize = 64 * 1024;
+
+    const char *m_path;
+    const char *m_tempPath;
+    int m_fd;
+    std::size_t m_used = 0;
+    char m_buffer[kBufferSize];
+
+    bool drain();
+};
+
+// Read-only mapping of a snapshot file, validated on open
+class MappedSnapshot {
+   public:
+    static std::expected<MappedSnapshot, std::string> Open(
+        const std::string &path);
+
+    MappedSnapshot(MappedSnapshot &&other) noexcept;
+    MappedSnapshot &operator=(MappedSnapshot &&) = delete;
+    ~MappedSnapshot();
+
+    const SnapshotHeader &header() const
+    {
+        return *static_cast<const SnapshotHeader *>(m_data);
+    }
+
+    std::span<const SnapshotInstrument> instruments() const;
+    std::span<const SnapshotOrder> orders() const;
+
+    std::string_view name(const SnapshotInstrument &instrument) const
+    {
+        return {static_cast<const char *>(m_data) + instrument.nameOffset,
+                instrument.nameLength};
+    }
+
+   private:
+    MappedSnapshot(const void *data, std::size_t size)
+        : m_data(data), m_size(size)
+    {
+    }
+
+    const void *m_data;
+    std::size_t m_size;
+};
+
+// A snapshot being written by a forked child
+class SnapshotJob {
+   public:
+    explicit SnapshotJob(pid_t pid) : m_pid(pid) {}
+
+    // Block until the child exits
+    // @return success or descriptive error
+    std::expected<void, std::string> wait();
+
+   private:
+    pid_t m_pid;
+};
+
+// Write exchange's books to sink. Does not allocate.
+template <ExchangeListener Listener>
+bool WriteSnapshot(const BasicExchange<Listener> &exchange,
+                   std::uint64_t journalSequence, SnapshotSink &sink)
+{
+    auto countOrders = [&exchange](InstrumentId id, Side side) {
+        std::uint64_t count = 0;
+        exchange.forEachOrder(id, side, [&count](auto &&...) { ++count; });
+        return count;
+    };
+    std::size_t instruments = exchange.instrumentCount();
+    std::uint64_t orders = 0;
+    for (InstrumentId id = 0; id < instruments; ++id) {
+        orders += countOrders(id, Side::BUY) + countOrders(id, Side::SELL);
+    }
+    SnapshotHeader header{};
+    std::copy(std::begin(SnapshotHeader::kMagic),
+              std::end(SnapshotHeader::kMagic), header.magic);
+    header.journalSequence = journalSequence;
+    header.nextOrderId = exchange.nextOrderId();
+    header.instrumentCount = instruments;
+    header.orderCount = orders;
+    bool ok = sink.write(&header, sizeof(header));
+
+    std::uint64_t nameOffset = sizeof(SnapshotHeader) +
+                               instruments * sizeof(SnapshotInstrument) +
+                               orders * sizeof(SnapshotOrder);
+    for (InstrumentId id = 0; id < instruments; ++id) {
+        const PriceBand *band = exchange.instrumentBand(id);
+        SnapshotInstrument entry{};
+        entry.band = band != nullptr ? *band : PriceBand{};
+        entry.nameOffset = nameOffset;
+        entry.nameLength = exchange.instrumentName(id).size();
+        entry.bidCount = countOrders(id, Side::BUY);
+        entry.askCount = countOrders(id, Side::SELL);
+        nameOffset += entry.nameLength;
+        ok = ok && sink.write(&entry, sizeof(entry));
+    }
+
+    auto writeOrder = [&](std::uint64_t orderId, std::int64_t price,
+                          std::uint32_t quantity, AccountId account) {
+        SnapshotOrder order{orderId, price, quantity, account, 0};
+        ok = ok && sink.write(&order, sizeof(order));
+    };
+    for (InstrumentId id = 0; id < instruments; ++id) {
+        exchange.forEachOrder(id, Side::BUY, writeOrder);
+        exchange.forEachOrder(id, Side::SELL, writeOrder);
+    }
+    for (InstrumentId id = 0; id < instruments; ++id) {
+        const std::string &name = exchange.instrumentName(id);
+        ok = ok && sink.write(name.data(), name.size());
+    }
+    return ok && sink.commit();
+}
+
+// Write a snapshot to path synchronously
+// @return success or descriptive error
+template <ExchangeListener Listener>
+std::expected<void, std::string> WriteSnapshot(
+    const BasicExchange<Listener> &exchange, const std::string &path,
+    std::uint64_t journalSequence)
+{
+    std::string tempPath = path + ".tmp";
+    SnapshotSink sink(path.c_str(), tempPath.c_str());
+    if (!WriteSnapshot(exchange, journalSequence, sink)) {
+        return std::unexpected("Cannot write snapshot " + path);
+    }
+    return {};
+}
+
+namespace detail {
+// @return child pid, 0 in the child, or -1
+pid_t forkSnapshotChild();
+[[noreturn]] void exitSnapshotChild(bool success);
+}  // namespace detail
+
+// Write a snapshot to path from a forked child, which sees the books frozen
+// by copy-on-write while the caller resumes matching at once. The calling
+// thread must be the only one touching exchange.
+// @return handle to wait on or descriptive error
+template <ExchangeListener Listener>
+std::expected<SnapshotJob, std::string> ForkSnapshot(
+    const BasicExchange<Listener> &exchange, const std::string &path,
+    std::uint64_t journalSequence)
+{
+    // Allocate before forking, the child must not
+    std::string tempPath = path + ".tmp";
+    pid_t pid = detail::forkSnapshotChild();
+    if (pid < 0) {
+        return std::unexpected("Cannot fork snapshot writer");
+    }
+    if (pid == 0) {
+        bool written = false;
+        {
+            SnapshotSink sink(path.c_str(), tempPath.c_str());
+            written = WriteSnapshot(exchange, journalSequence, sink);
+        }
+        detail::exitSnapshotChild(written);
+    }
+    return SnapshotJob(pid);
+}
+
+// Restore the books of an exchange that has no instruments yet from a
+// snapshot, re-adding each side's orders best first so that levels and time
+// priority come back as they were. As with ReplayJournal the listener sees
+// the restored orders.
+// @return journal sequence to replay from or descriptive error
+template <ExchangeListener Listener>
+std::expected<std::uint64_t, std::string> LoadSnapshot(
+    const std::string &path, BasicExchange<Listener> &exchange)
+{
+    auto snapshot = MappedSnapshot::Open(path);
+    if (!snapshot) {
+        return std::unexpected(snapshot.error());
+    }
+    if (exchange.instrumentCount() != 0) {
+        return std::unexpected("Exchange already has instruments");
+    }
+    const SnapshotOrder *order = snapshot->orders().data();
+    for (const SnapshotInstrument &entry : snapshot->instruments()) {
+        std::string name(snapshot->name(entry));
+        InstrumentId id = 0;
+        if (entry.band.tickSize == 0) {
+            id = exchange.GetInstrumentId(name);
+        }
+        else {
+            auto registered = exchange.RegisterInstrument(name, entry.band);
+            if (!registered) {
+                return std::unexpected(registered.error());
+            }
+            id = *registered;
+        }
+        // Every order must come back resting with its whole quantity, one
+        // the exchange refuses or that trades means the snapshot's books
+        // were not the ones it recorded
+        auto restore = [&](Side side, std::uint64_t count) {
+            for (std::uint64_t i = 0; i < count; ++i, ++order) {
+                auto added = exchange.AddOrderWithId(
+                    id, side, order->orderId, order->price, order->quantity,
+                    TimeInForce::GTC, OrderType::LIMIT, order->account);
+                if (!added ||
+                    exchange.orderQuantity(order->orderId) != order->quantity) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (!restore(Side::BUY, entry.bidCount) ||
+            !restore(Side::SELL, entry.askCount)) {
+            return std::unexpected("Snapshot does not match the exchange");
+        }
+    }
+    exchange.ReserveOrderIds(snapshot->header().nextOrderId);
+    return snapshot->header().journalSequence;
+}
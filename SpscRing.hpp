@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Producer and consumer state are kept on separate cache lines of this size
+inline constexpr std::size_t kCacheLineSize = 64;
+
+// Spin-wait hint for busy-polling loops
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Bounded single-producer/single-consumer queue. Exactly one thread may push
+// and exactly one thread may pop; neither side ever blocks or allocates.
+// Each side keeps a private copy of the other side's index and only reloads
+// it when the copy says the ring is full (or empty), so a busy-polling
+// consumer does not keep pulling the producer's cache line across cores.
+template <typename T>
+class SpscRing {
+   public:
+    // @param capacity rounded up to a power of two
+    explicit SpscRing(std::size_t capacity)
+        : m_slots(std::bit_ceil(capacity < 2 ? 2 : capacity)),
+          m_mask(m_slots.size() - 1)
+    {
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // @return false if the ring is full
+    bool tryPush(const T &item) { return tryPushBatch({&item, 1}) == 1; }
+
+    // Push as many of items as fit, publishing them to the consumer at once
+    // @return number of items pushed
+    std::size_t tryPushBatch(std::span<const T> items)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        std::size_t space = m_slots.size() - (tail - m_cachedHead);
+        if (space < items.size()) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            space = m_slots.size() - (tail - m_cachedHead);
+        }
+        std::size_t count = std::min(space, items.size());
+        for (std::size_t i = 0; i < count; ++i) {
+            m_slots[(tail + i) & m_mask] = items[i];
+        }
+        if (count != 0) {
+            m_tail.store(tail + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // Push all of items, publishing them to the consumer at once, or none
+    // @return false if they do not all fit
+    bool tryPushAll(std::span<const T> items)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_slots.size() - (tail - m_cachedHead) < items.size()) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (m_slots.size() - (tail - m_cachedHead) < items.size()) {
+                return false;
+            }
+        }
+        return tryPushBatch(items) == items.size();
+    }
+
+    // @return false if the ring is empty
+    bool tryPop(T &item)
+    {
+        return popBatch([&item](const T &slot) { item = slot; }, 1) == 1;
+    }
+
+    // Hand up to maxItems queued items to func in FIFO order, reading them in
+    // place. Their slots are released to the producer once, after the batch.
+    // @return number of items consumed
+    template <typename Func>
+    std::size_t popBatch(Func &&func,
+                         std::size_t maxItems =
+                             std::numeric_limits<std::size_t>::max())
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (m_cachedTail == head) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (m_cachedTail == head) {
+                return 0;
+            }
+        }
+        std::size_t count = std::min(m_cachedTail - head, maxItems);
+        for (std::size_t i = 0; i < count; ++i) {
+            func(m_slots[(head + i) & m_mask]);
+        }
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) ==
+               m_tail.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const { return m_slots.size(); }
+
+   private:
+    std::vector<T> m_slots;
+    std::size_t m_mask;
+
+    // Next slot to pop, written by the consumer only
+    alignas(kCacheLineSize) std::atomic<std::size_t> m_head{0};
+    std::size_t m_cachedTail = 0;
+
+    // Next slot to push, written by the producer only
+    alignas(kCacheLineSize) std::atomic<std::size_t> m_tail{0};
+    std::size_t m_cachedHead = 0;
+};
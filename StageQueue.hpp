@@ -0,0 +1,273 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+// Throughput and backpressure counters of one pipeline stage
+struct StageStats {
+    // Items the stage has finished with
+    std::uint64_t processed = 0;
+    // Times the stage waited for room downstream, and for how long in total
+    std::uint64_t stalls = 0;
+    std::uint64_t stalledNanos = 0;
+    // Items waiting in the stage's input queue, now and at most so far
+    std::size_t queueDepth = 0;
+    std::size_t maxQueueDepth = 0;
+    std::size_t queueCapacity = 0;
+};
+
+// Coroutine running one pipeline stage. It starts suspended, is resumed by
+// a StageScheduler only, and its frame lives until the task is destroyed.
+class StageTask {
+   public:
+    struct promise_type {
+        StageTask get_return_object()
+        {
+            return StageTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    StageTask(StageTask &&other) noexcept
+        : m_handle(std::exchange(other.m_handle, {}))
+    {
+    }
+    StageTask &operator=(StageTask &&) = delete;
+
+    ~StageTask()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    std::coroutine_handle<> handle() const { return m_handle; }
+
+   private:
+    explicit StageTask(std::coroutine_handle<promise_type> handle)
+        : m_handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+// Resumes the stages of a pipeline on the calling thread, round robin, for
+// as long as any of them can make progress. A stage is only ever waiting on
+// one thing, so the ready list never holds more entries than there are
+// stages and does not allocate once warmed up.
+class StageScheduler {
+   public:
+    // Make stage ready to run
+    void schedule(std::coroutine_handle<> stage) { m_ready.push_back(stage); }
+
+    // Suspend the running stage until the next run(), e.g. to retry a sink
+    // that is full, charging the wait to stats
+    auto nextRun(StageStats &stats)
+    {
+        struct Awaiter {
+            StageScheduler &scheduler;
+            StageStats &stats;
+            std::chrono::steady_clock::time_point since;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> stage)
+            {
+                ++stats.stalls;
+                since = std::chrono::steady_clock::now();
+                scheduler.m_deferred.push_back(stage);
+            }
+            void await_resume()
+            {
+                stats.stalledNanos += static_cast<std::uint64_t>(
+                    std::chrono::nanoseconds(
+                        std::chrono::steady_clock::now() - since)
+                        .count());
+            }
+        };
+        return Awaiter{*this, stats, {}};
+    }
+
+    // Run the stages deferred to this run and whatever becomes ready, until
+    // every stage waits
+    void run()
+    {
+        m_ready.insert(m_ready.end(), m_deferred.begin(), m_deferred.end());
+        m_deferred.clear();
+        while (!m_ready.empty()) {
+            m_running.swap(m_ready);
+            for (std::coroutine_handle<> stage : m_running) {
+                stage.resume();
+            }
+            m_running.clear();
+        }
+    }
+
+    // True if some stage waits for the next run()
+    bool hasDeferred() const { return !m_deferred.empty(); }
+
+   private:
+    std::vector<std::coroutine_handle<>> m_ready;
+    std::vector<std::coroutine_handle<>> m_running;
+    std::vector<std::coroutine_handle<>> m_deferred;
+};
+
+// Wakes a stage waiting for input that arrives from outside the pipeline
+class StageSignal {
+   public:
+    // Suspend the running stage until the next notify()
+    auto wait()
+    {
+        struct Awaiter {
+            StageSignal &signal;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> stage)
+            {
+                signal.m_waiter = stage;
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    void notify(StageScheduler &scheduler)
+    {
+        if (m_waiter) {
+            scheduler.schedule(std::exchange(m_waiter, {}));
+        }
+    }
+
+   private:
+    std::coroutine_handle<> m_waiter;
+};
+
+// Bounded FIFO from one stage to the next on the same StageScheduler. A
+// stage pushing into a full queue suspends until the consumer makes room,
+// with the wait charged to the pushing stage's stats, and a stage popping
+// from an empty queue suspends until an item arrives. Memory between the
+// stages is therefore fixed and a slow stage holds back the ones before it.
+template <typename T>
+class StageQueue {
+   public:
+    // @param stats counters of the consuming stage, whose queue this is
+    StageQueue(StageScheduler &scheduler, std::size_t capacity,
+               StageStats &stats)
+        : m_scheduler(scheduler),
+          m_slots(capacity != 0 ? capacity : 1),
+          m_stats(stats)
+    {
+        m_stats.queueCapacity = m_slots.size();
+    }
+
+    StageQueue(const StageQueue &) = delete;
+    StageQueue &operator=(const StageQueue &) = delete;
+
+    // co_await to move item in, waiting for room charged to producer. The
+    // awaiter only refers to item, which must outlive the co_await.
+    auto push(T &item, StageStats &producer)
+    {
+        struct Awaiter {
+            StageQueue &queue;
+            T &item;
+            StageStats &stats;
+            std::chrono::steady_clock::time_point since{};
+
+            bool await_ready() const noexcept { return !queue.full(); }
+            void await_suspend(std::coroutine_handle<> stage)
+            {
+                ++stats.stalls;
+                since = std::chrono::steady_clock::now();
+                queue.m_producer = stage;
+            }
+            void await_resume()
+            {
+                if (since != std::chrono::steady_clock::time_point{}) {
+                    stats.stalledNanos += static_cast<std::uint64_t>(
+                        std::chrono::nanoseconds(
+                            std::chrono::steady_clock::now() - since)
+                            .count());
+                }
+                queue.put(std::move(item));
+            }
+        };
+        return Awaiter{*this, item, producer};
+    }
+
+    // co_await to take the oldest item, waiting for one if empty
+    auto pop()
+    {
+        struct Awaiter {
+            StageQueue &queue;
+
+            bool await_ready() const noexcept { return queue.m_size != 0; }
+            void await_suspend(std::coroutine_handle<> stage)
+            {
+                queue.m_consumer = stage;
+            }
+            T await_resume() { return queue.take(); }
+        };
+        return Awaiter{*this};
+    }
+
+    // Take the oldest item without waiting
+    // @return false if the queue is empty
+    bool tryPop(T &item)
+    {
+        if (m_size == 0) {
+            return false;
+        }
+        item = take();
+        return true;
+    }
+
+    // Oldest item, null if the queue is empty
+    const T *front() const { return m_size != 0 ? &m_slots[m_head] : nullptr; }
+
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == m_slots.size(); }
+
+   private:
+    void put(T item)
+    {
+        m_slots[(m_head + m_size) % m_slots.size()] = std::move(item);
+        ++m_size;
+        m_stats.queueDepth = m_size;
+        if (m_size > m_stats.maxQueueDepth) {
+            m_stats.maxQueueDepth = m_size;
+        }
+        if (m_consumer) {
+            m_scheduler.schedule(std::exchange(m_consumer, {}));
+        }
+    }
+
+    T take()
+    {
+        T item = std::move(m_slots[m_head]);
+        m_head = (m_head + 1) % m_slots.size();
+        --m_size;
+        m_stats.queueDepth = m_size;
+        if (m_producer) {
+            m_scheduler.schedule(std::exchange(m_producer, {}));
+        }
+        return item;
+    }
+
+    StageScheduler &m_scheduler;
+    std::vector<T> m_slots;
+    std::size_t m_head = 0;
+    std::size_t m_size = 0;
+    StageStats &m_stats;
+    // Stages suspended on this queue, if any
+    std::coroutine_handle<> m_producer;
+    std::coroutine_handle<> m_consumer;
+};
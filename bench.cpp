@@ -0,0 +1,511 @@
+// Throughput and latency benchmark of the matching engine.
+//
+//   exchange_bench [--orders N] [--depth D] [--cancel-ratio R]
+//                  [--aggressive-ratio R] [--instruments I] [--seed S]
+//                  [--record FILE] [--replay FILE]
+//
+// Runs the add, cancel, sweep and mixed scenarios on synthetic flow, or only
+// replays FILE when --replay is given. --record writes the mixed flow to FILE
+// in the replay format, one command per line:
+//
+//   A <instrument> <B|S> <price> <quantity>
+//   X <instrument> <B|S> <n>      cancel the order added by the n-th A line
+//
+// Each command is timed individually; throughput is over the whole timed run.
+// Built with EXCHANGE_LATENCY_STATS, the timed commands are also broken down
+// into engine stages, in TSC cycles.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BasicExchange.hpp"
+#include "LatencyStats.hpp"
+
+namespace {
+
+// Keeps the compiler from discarding the listener calls
+struct CountingListener {
+    std::uint64_t trades = 0;
+    std::uint64_t bestPriceChanges = 0;
+
+    void OnOrderTraded(InstrumentId, std::uint64_t, std::int64_t,
+                       std::uint32_t)
+    {
+        ++trades;
+    }
+
+    void OnBestPriceChanged(InstrumentId, std::int64_t, std::uint32_t,
+                            std::int64_t, std::uint32_t)
+    {
+        ++bestPriceChanges;
+    }
+
+#ifdef EXCHANGE_LATENCY_STATS
+    LatencyStats *latency = nullptr;
+
+    void OnStageLatency(InstrumentId instrument, LatencyStage stage,
+                        std::uint64_t elapsed)
+    {
+        if (latency != nullptr) {
+            latency->record(instrument, stage, elapsed);
+        }
+    }
+#endif
+};
+
+using BenchExchange = BasicExchange<CountingListener>;
+
+struct Op {
+    enum class Type : std::uint8_t { ADD, CANCEL };
+
+    Type type;
+    Side side;
+    // Untimed commands set up the book for the timed ones
+    bool timed;
+    std::uint32_t instrument;  // index into Flow::instruments
+    std::int64_t price;
+    std::uint32_t quantity;
+    // CANCEL only, index of the ADD among the flow's adds
+    std::uint32_t addIndex;
+};
+
+struct Flow {
+    std::vector<std::string> instruments;
+    std::vector<Op> ops;
+    std::uint32_t addCount = 0;
+
+    void add(std::uint32_t instrument, Side side, std::int64_t price,
+             std::uint32_t quantity, bool timed = true)
+    {
+        ops.push_back(
+            Op{Op::Type::ADD, side, timed, instrument, price, quantity, 0});
+        ++addCount;
+    }
+
+    void cancel(std::uint32_t instrument, Side side, std::uint32_t addIndex,
+                bool timed = true)
+    {
+        ops.push_back(
+            Op{Op::Type::CANCEL, side, timed, instrument, 0, 0, addIndex});
+    }
+};
+
+struct Config {
+    std::size_t orders = 1'000'000;
+    std::uint32_t depth = 100;
+    double cancelRatio = 0.4;
+    double aggressiveRatio = 0.1;
+    std::uint32_t instruments = 8;
+    std::uint64_t seed = 1;
+    std::string recordFile;
+    std::string replayFile;
+};
+
+constexpr std::int64_t kMidPrice = 100'000;
+
+class Generator {
+   public:
+    explicit Generator(const Config &config)
+        : m_config(config), m_rng(config.seed)
+    {
+    }
+
+    Flow instruments() const
+    {
+        Flow flow;
+        for (std::uint32_t i = 0; i < m_config.instruments; ++i) {
+            flow.instruments.push_back("SYM" + std::to_string(i));
+        }
+        return flow;
+    }
+
+    std::uint32_t instrument()
+    {
+        return uniform<std::uint32_t>(0, m_config.instruments - 1);
+    }
+
+    Side side() { return m_rng() & 1 ? Side::BUY : Side::SELL; }
+
+    std::uint32_t quantity() { return uniform<std::uint32_t>(1, 100); }
+
+    // A price resting within depth ticks behind the touch
+    std::int64_t passivePrice(Side side)
+    {
+        auto offset = uniform<std::int64_t>(1, m_config.depth);
+        return side == Side::BUY ? kMidPrice - offset : kMidPrice + offset;
+    }
+
+    // A price crossing up to depth levels into the opposite side
+    std::int64_t aggressivePrice(Side side)
+    {
+        auto offset = uniform<std::int64_t>(1, m_config.depth);
+        return side == Side::BUY ? kMidPrice + offset : kMidPrice - offset;
+    }
+
+    double unit() { return std::uniform_real_distribution<>(0, 1)(m_rng); }
+
+    template <typename T>
+    T uniform(T low, T high)
+    {
+        return std::uniform_int_distribution<T>(low, high)(m_rng);
+    }
+
+   private:
+    const Config &m_config;
+    std::mt19937_64 m_rng;
+};
+
+// Resting orders only, never crossing
+Flow addFlow(const Config &config)
+{
+    Generator gen(config);
+    Flow flow = gen.instruments();
+    for (std::size_t i = 0; i < config.orders; ++i) {
+        Side side = gen.side();
+        flow.add(gen.instrument(), side, gen.passivePrice(side),
+                 gen.quantity());
+    }
+    return flow;
+}
+
+// Cancel every resting order in random order
+Flow cancelFlow(const Config &config)
+{
+    Flow flow = addFlow(config);
+    for (Op &op : flow.ops) {
+        op.timed = false;
+    }
+    std::vector<std::uint32_t> order(flow.addCount);
+    for (std::uint32_t i = 0; i < flow.addCount; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(config.seed));
+    std::vector<Op> adds = flow.ops;
+    for (std::uint32_t index : order) {
+        flow.cancel(adds[index].instrument, adds[index].side, index);
+    }
+    return flow;
+}
+
+// Build depth ask levels of a few orders each, then take them all out with
+// one buy. Only the sweeping orders are timed.
+Flow sweepFlow(const Config &config)
+{
+    constexpr std::uint32_t kOrdersPerLevel = 4;
+    constexpr std::uint32_t kQuantity = 10;
+
+    Generator gen(config);
+    Flow flow = gen.instruments();
+    std::size_t perRound = config.depth * kOrdersPerLevel + 1;
+    std::size_t rounds = std::max<std::size_t>(1, config.orders / perRound);
+    for (std::size_t round = 0; round < rounds; ++round) {
+        std::uint32_t instrument = gen.instrument();
+        for (std::uint32_t level = 1; level <= config.depth; ++level) {
+            for (std::uint32_t i = 0; i < kOrdersPerLevel; ++i) {
+                flow.add(instrument, Side::SELL, kMidPrice + level, kQuantity,
+                         false);
+            }
+        }
+        flow.add(instrument, Side::BUY, kMidPrice + config.depth,
+                 config.depth * kOrdersPerLevel * kQuantity);
+    }
+    return flow;
+}
+
+// Passive adds, aggressive adds and cancels of live orders, in the configured
+// proportions
+Flow mixedFlow(const Config &config)
+{
+    Generator gen(config);
+    Flow flow = gen.instruments();
+    // Adds that may still be resting, cancelled at random
+    std::vector<std::uint32_t> live;
+    std::vector<Op> adds;
+    for (std::size_t i = 0; i < config.orders; ++i) {
+        double draw = gen.unit();
+        if (draw < config.cancelRatio && !live.empty()) {
+            auto slot = gen.uniform<std::size_t>(0, live.size() - 1);
+            std::uint32_t index = live[slot];
+            live[slot] = live.back();
+            live.pop_back();
+            flow.cancel(adds[index].instrument, adds[index].side, index);
+            continue;
+        }
+        Side side = gen.side();
+        bool aggressive = draw < config.cancelRatio + config.aggressiveRatio;
+        std::int64_t price =
+            aggressive ? gen.aggressivePrice(side) : gen.passivePrice(side);
+        live.push_back(flow.addCount);
+        flow.add(gen.instrument(), side, price, gen.quantity());
+        adds.push_back(flow.ops.back());
+    }
+    return flow;
+}
+
+std::optional<Flow> readFlow(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open " << path << "\n";
+        return std::nullopt;
+    }
+    Flow flow;
+    std::unordered_map<std::string, std::uint32_t> instruments;
+    std::string line;
+    for (std::size_t number = 1; std::getline(in, line); ++number) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        char type = 0;
+        char side = 0;
+        std::string name;
+        fields >> type >> name >> side;
+        auto [iter, inserted] = instruments.try_emplace(
+            name, static_cast<std::uint32_t>(flow.instruments.size()));
+        if (inserted) {
+            flow.instruments.push_back(name);
+        }
+        Side order_side = side == 'B' ? Side::BUY : Side::SELL;
+        if (type == 'A') {
+            std::int64_t price = 0;
+            std::uint32_t quantity = 0;
+            if (fields >> price >> quantity) {
+                flow.add(iter->second, order_side, price, quantity);
+                continue;
+            }
+        }
+        else if (type == 'X') {
+            std::uint32_t index = 0;
+            if (fields >> index && index < flow.addCount) {
+                flow.cancel(iter->second, order_side, index);
+                continue;
+            }
+        }
+        std::cerr << path << ":" << number << ": malformed command\n";
+        return std::nullopt;
+    }
+    return flow;
+}
+
+bool writeFlow(const Flow &flow, const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+    for (const Op &op : flow.ops) {
+        char side = op.side == Side::BUY ? 'B' : 'S';
+        const std::string &name = flow.instruments[op.instrument];
+        if (op.type == Op::Type::ADD) {
+            out << "A " << name << ' ' << side << ' ' << op.price << ' '
+                << op.quantity << '\n';
+        }
+        else {
+            out << "X " << name << ' ' << side << ' ' << op.addIndex << '\n';
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+#ifdef EXCHANGE_LATENCY_STATS
+void printStages(const LatencyStats &stats, std::size_t instruments)
+{
+    constexpr const char *kStageNames[kLatencyStageCount] = {
+        "lookup", "match", "rest", "cancel", "dispatch"};
+    for (std::size_t stage = 0; stage < kLatencyStageCount; ++stage) {
+        LatencySnapshot total;
+        for (InstrumentId id = 0; id < instruments; ++id) {
+            LatencySnapshot one =
+                stats.snapshot(id, static_cast<LatencyStage>(stage));
+            for (std::size_t i = 0; i < LatencySnapshot::kBucketCount; ++i) {
+                total.counts[i] += one.counts[i];
+            }
+        }
+        if (total.count() == 0) {
+            continue;
+        }
+        std::cout << "  " << std::left << std::setw(9) << kStageNames[stage]
+                  << std::right << std::setw(10) << total.count()
+                  << "  p50=" << total.percentile(0.50) << "cy"
+                  << " p99=" << total.percentile(0.99) << "cy"
+                  << " p99.9=" << total.percentile(0.999) << "cy\n";
+    }
+}
+#endif
+
+void run(const std::string &scenario, const Flow &flow)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr auto kRejected = std::numeric_limits<std::uint64_t>::max();
+
+    BenchExchange exchange;
+    std::vector<InstrumentId> ids;
+    for (const std::string &name : flow.instruments) {
+        ids.push_back(exchange.GetInstrumentId(name));
+    }
+    // Order id of each add, by its index among the flow's adds
+    std::vector<std::uint64_t> orderIds;
+    orderIds.reserve(flow.addCount);
+    std::vector<std::uint64_t> latencies;
+    latencies.reserve(flow.ops.size());
+    std::uint64_t rejected = 0;
+#ifdef EXCHANGE_LATENCY_STATS
+    LatencyStats stats(ids.size());
+#endif
+
+    auto apply = [&](const Op &op) {
+        InstrumentId instrument = ids[op.instrument];
+        if (op.type == Op::Type::ADD) {
+            auto result =
+                exchange.AddOrder(instrument, op.side, op.price, op.quantity);
+            orderIds.push_back(result ? *result : kRejected);
+            rejected += !result;
+        }
+        else if (orderIds[op.addIndex] != kRejected) {
+            exchange.RemoveOrder(instrument, op.side, orderIds[op.addIndex]);
+        }
+    };
+
+    Clock::duration total{};
+    for (const Op &op : flow.ops) {
+#ifdef EXCHANGE_LATENCY_STATS
+        exchange.listener().latency = op.timed ? &stats : nullptr;
+#endif
+        if (!op.timed) {
+            apply(op);
+            continue;
+        }
+        auto start = Clock::now();
+        apply(op);
+        auto elapsed = Clock::now() - start;
+        total += elapsed;
+        latencies.push_back(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count()));
+    }
+
+    if (latencies.empty()) {
+        std::cout << std::left << std::setw(8) << scenario << " no commands\n";
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        auto rank = static_cast<std::size_t>(p * (latencies.size() - 1));
+        return latencies[rank];
+    };
+    double seconds = std::chrono::duration<double>(total).count();
+    std::cout << std::left << std::setw(8) << scenario << std::right
+              << std::setw(10) << latencies.size() << " ops "
+              << std::fixed << std::setprecision(2) << std::setw(8)
+              << latencies.size() / seconds / 1e6 << " Mops/s"
+              << "  p50=" << percentile(0.50) << "ns"
+              << " p99=" << percentile(0.99) << "ns"
+              << " p99.9=" << percentile(0.999) << "ns"
+              << " max=" << latencies.back() << "ns"
+              << "  trades=" << exchange.listener().trades
+              << " bbo=" << exchange.listener().bestPriceChanges
+              << " rejected=" << rejected << "\n";
+#ifdef EXCHANGE_LATENCY_STATS
+    printStages(stats, ids.size());
+#endif
+}
+
+void usage()
+{
+    std::cerr << "usage: exchange_bench [--orders N] [--depth D] "
+                 "[--cancel-ratio R] [--aggressive-ratio R]\n"
+                 "                      [--instruments I] [--seed S] "
+                 "[--record FILE] [--replay FILE]\n";
+}
+
+std::optional<Config> parseArgs(int argc, char **argv)
+{
+    Config config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 == argc) {
+            return std::nullopt;
+        }
+        std::string value = argv[++i];
+        if (arg == "--orders") {
+            config.orders = std::stoull(value);
+        }
+        else if (arg == "--depth") {
+            config.depth = static_cast<std::uint32_t>(std::stoul(value));
+        }
+        else if (arg == "--cancel-ratio") {
+            config.cancelRatio = std::stod(value);
+        }
+        else if (arg == "--aggressive-ratio") {
+            config.aggressiveRatio = std::stod(value);
+        }
+        else if (arg == "--instruments") {
+            config.instruments = static_cast<std::uint32_t>(std::stoul(value));
+        }
+        else if (arg == "--seed") {
+            config.seed = std::stoull(value);
+        }
+        else if (arg == "--record") {
+            config.recordFile = value;
+        }
+        else if (arg == "--replay") {
+            config.replayFile = value;
+        }
+        else {
+            return std::nullopt;
+        }
+    }
+    if (config.depth == 0 || config.instruments == 0) {
+        return std::nullopt;
+    }
+    return config;
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    std::optional<Config> config;
+    try {
+        config = parseArgs(argc, argv);
+    }
+    catch (const std::exception &) {
+    }
+    if (!config) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!config->replayFile.empty()) {
+        std::optional<Flow> flow = readFlow(config->replayFile);
+        if (!flow) {
+            return EXIT_FAILURE;
+        }
+        run("replay", *flow);
+        return EXIT_SUCCESS;
+    }
+
+    run("add", addFlow(*config));
+    run("cancel", cancelFlow(*config));
+    run("sweep", sweepFlow(*config));
+    Flow mixed = mixedFlow(*config);
+    run("mixed", mixed);
+    if (!config->recordFile.empty() && !writeFlow(mixed, config->recordFile)) {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "Exchange.hpp"
+#include "OrderEntry.hpp"
+#include "Pipeline.hpp"
+
+namespace {
+
+// Append one order entry message and its header to wire
+template <typename Message>
+void appendMessage(std::vector<std::byte> &wire, const Message &message)
+{
+    OrderEntryHeader header{sizeof(Message), Message::kTemplateId,
+                            OrderEntryHeader::kSchemaId,
+                            OrderEntryHeader::kVersion};
+    std::size_t offset = wire.size();
+    wire.resize(offset + sizeof(header) + sizeof(message));
+    std::memcpy(wire.data() + offset, &header, sizeof(header));
+    std::memcpy(wire.data() + offset + sizeof(header), &message,
+                sizeof(message));
+}
+
+}  // namespace
+
+int main()
+{
+    // Size the books for the session and fault them in before trading
+    Exchange ex(ExchangeConfig{.instruments = 1});
+    ex.GetInstrumentId("AAPL");
+    ex.Prewarm();
+    auto orderTraded = [](const std::string &instrument, std::uint64_t orderId,
+                          std::int64_t tradedPrice,
+                          std::uint32_t tradedQuantity) {
+        std::cout << "Order Traded!\nInstrument=" << instrument
+                  << ", OrderId=" << orderId << ", TradedPrice=" << tradedPrice
+                  << ", Traded Quantity=" << tradedQuantity << "\n";
+    };
+    auto bestPriceChanged =
+        [](const std::string &instrument, std::int64_t bidPrice,
+           std::uint32_t bidTotalQuantity, std::int64_t askPrice,
+           std::uint32_t askTotalQuantity) {
+            std::cout << "Best Price Changed!\nInstrument=" << instrument
+                      << ", BidPrice=" << bidPrice
+                      << ", BidTotalQuantity=" << bidTotalQuantity
+                      << ", AskPrice=" << askPrice
+                      << ", AskTotalQuantity=" << askTotalQuantity << "\n";
+        };
+    ex.OrderTraded = orderTraded;
+    ex.BestPriceChanged = bestPriceChanged;
+
+    // Add some resting orders
+    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::SELL, 75, 750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::BUY, 70, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::SELL, 76, 750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::BUY, 68, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::SELL, 73, 750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Partial order executes
+    assert(ex.AddOrder("AAPL", Side::SELL, 70, 750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Level clears
+    assert(ex.AddOrder("AAPL", Side::SELL, 70, 750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Clear a level, then partially another level
+    assert(ex.AddOrder("AAPL", Side::BUY, 73, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Add on existing levels
+    assert(ex.AddOrder("AAPL", Side::BUY, 69, 500));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    auto queued = ex.AddOrder("AAPL", Side::BUY, 68, 1000);
+    assert(queued);
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Clear through two and a bit orders on level
+    assert(ex.AddOrder("AAPL", Side::SELL, 69, 1750));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Add some more resting orders
+    auto resting = ex.AddOrder("AAPL", Side::BUY, 69, 1000);
+    assert(resting);
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+    assert(ex.AddOrder("AAPL", Side::BUY, 69, 1000));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Test removing one
+    assert(ex.RemoveOrder("AAPL", Side::BUY, *resting));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Test fail removing
+    assert(!ex.RemoveOrder("AAPL", Side::BUY, 3));
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Fill-or-kill for more than the bids hold down to its price is rejected
+    InstrumentId aapl = ex.GetInstrumentId("AAPL");
+    auto killed = ex.AddOrder(aapl, Side::SELL, 68, 5000, TimeInForce::FOK,
+                              OrderType::LIMIT);
+    assert(!killed);
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Immediate-or-cancel trades what it can at its price and books nothing
+    auto immediate = ex.AddOrder(aapl, Side::BUY, 73, 1000, TimeInForce::IOC,
+                                 OrderType::LIMIT);
+    assert(immediate);
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Market order trades at whatever price the book offers
+    auto market = ex.AddOrder(aapl, Side::SELL, 0, 1000, TimeInForce::IOC,
+                              OrderType::MARKET);
+    assert(market);
+    ex.printInstrumentBooks("AAPL");
+    std::cout << "\n";
+
+    // Queue position and depth come from the book without matching
+    auto ahead = queued ? ex.queuePosition(*queued) : std::nullopt;
+    assert(ahead.has_value());
+    if (ahead) {
+        std::cout << "Quantity ahead of id=" << *queued << ": " << *ahead
+                  << "\n";
+    }
+    std::cout << "Bid depth at 68 or better: "
+              << ex.depthToPrice(aapl, Side::BUY, 68) << "\n\n";
+
+    // Pre-trade risk rejects orders breaching their account's limits
+    PreTradeRisk risk;
+    auto limited = risk.setLimits(1, RiskLimits{.maxOrderQuantity = 500});
+    assert(limited);
+    ex.AttachRisk(&risk);
+    auto rejected = ex.AddOrder(aapl, Side::BUY, 70, 1000, TimeInForce::GTC,
+                                OrderType::LIMIT, 1);
+    assert(!rejected);
+    if (!rejected) {
+        std::cout << "Rejected for account 1: " << rejected.error() << "\n\n";
+    }
+    else {
+        std::cout << "Not rejected for account 1: id=" << *rejected << "\n\n";
+    }
+    ex.AttachRisk(nullptr);
+
+    // Mass cancel takes all of an account's orders off the books at once
+    auto accountBid = ex.AddOrder(aapl, Side::BUY, 60, 100, TimeInForce::GTC,
+                                  OrderType::LIMIT, 2);
+    assert(accountBid);
+    auto accountAsk = ex.AddOrder(aapl, Side::SELL, 80, 100, TimeInForce::GTC,
+                                  OrderType::LIMIT, 2);
+    assert(accountAsk);
+    std::cout << "Cancelled for account 2: " << ex.MassCancel(2) << "\n\n";
+
+    // An order entry session only cancels the orders of its own account
+    auto foreign = ex.AddOrder(aapl, Side::BUY, 60, 100, TimeInForce::GTC,
+                               OrderType::LIMIT, 3);
+    assert(foreign);
+    std::vector<std::byte> wire;
+    appendMessage(wire, CancelOrderMessage{1, *foreign});
+    auto printReply = [](std::uint64_t clientTag,
+                         const std::expected<std::uint64_t, std::string> &r) {
+        std::cout << "Cancel tag=" << clientTag << ": "
+                  << (r ? "cancelled id=" + std::to_string(*r) : r.error())
+                  << "\n";
+    };
+    for (AccountId account : {AccountId{4}, AccountId{3}}) {
+        OrderEntryDecoder<Exchange> session(ex, account);
+        std::cout << "Session of account " << account << " - ";
+        auto decoded = session.decode(wire, printReply);
+        assert(decoded && *decoded == wire.size());
+    }
+    std::cout << "\n";
+
+    // A batch quotes both sides at once and reports the new best prices once
+    BatchOrder quote[] = {{aapl, Side::BUY, 66, 200},
+                          {aapl, Side::BUY, 67, 200},
+                          {aapl, Side::SELL, 74, 200},
+                          {aapl, Side::SELL, 77, 200}};
+    std::expected<std::uint64_t, std::string> quoteIds[std::size(quote)];
+    [[maybe_unused]] std::size_t quoted = ex.AddOrders(quote, quoteIds);
+    assert(quoted == std::size(quote));
+    std::cout << "\n";
+
+    // Dump the book through a logger, which formats it on its own thread
+    std::cout.flush();
+    Logger logger(STDOUT_FILENO);
+    LogChannel &log = logger.openChannel();
+    [[maybe_unused]] bool dumped = ex.DumpBook(aapl, log);
+    assert(dumped);
+    log.flush();
+    std::cout << "\n";
+
+    // A session pipeline whose replies are refused stops taking input and
+    // leaves the rest of a burst to its caller until the sink drains
+    bool accepting = false;
+    std::size_t replies = 0;
+    PipelineSinks sinks;
+    sinks.replies = [&](std::uint64_t, const auto &) {
+        if (accepting) {
+            ++replies;
+        }
+        return accepting;
+    };
+    SessionPipeline pipeline(
+        std::move(sinks),
+        PipelineConfig{.inputBytes = 256,
+                       .commands = 4,
+                       .outputs = 4,
+                       .journalCommands = 4});
+    pipeline.GetInstrumentId("AAPL");
+    std::vector<std::byte> burst;
+    for (std::uint64_t tag = 0; tag < 64; ++tag) {
+        appendMessage(burst, NewOrderMessage{tag, "AAPL",
+                                             static_cast<std::int64_t>(tag),
+                                             100, Side::BUY, TimeInForce::GTC,
+                                             OrderType::LIMIT, 0});
+    }
+    auto taken = pipeline.Feed(burst);
+    assert(taken);
+    std::cout << "Pipeline took " << taken.value_or(0) << " of "
+              << burst.size() << " bytes, stalls: decode="
+              << pipeline.stats(PipelineStage::DECODE).stalls
+              << " match=" << pipeline.stats(PipelineStage::MATCH).stalls
+              << " publish=" << pipeline.stats(PipelineStage::PUBLISH).stalls
+              << "\n";
+    accepting = true;
+    std::span<const std::byte> rest =
+        std::span(burst).subspan(taken.value_or(burst.size()));
+    while (!rest.empty() || !pipeline.idle()) {
+        pipeline.Poll();
+        auto fed = pipeline.Feed(rest);
+        if (!fed) {
+            break;
+        }
+        rest = rest.subspan(*fed);
+    }
+    std::cout << "Replies once drained: " << replies
+              << ", idle=" << (pipeline.idle() ? "yes" : "no") << "\n";
+
+    return 0;
+}